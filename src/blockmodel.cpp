@@ -1,12 +1,23 @@
+#include <atomic>
+#include <cassert>
 #include "blockmodel.h"
 
+unsigned long blockmodel_t::epoch_t::next()
+{
+  // Starts at 1, so that 0 never matches a blockmodel.
+  static std::atomic<unsigned long> last(0);
+  return ++last;
+}
 
-blockmodel_t::blockmodel_t(const uint_vec_t & memberships, unsigned int g, unsigned int N, adj_list_t * adj_list_ptr) :
-random_block_(0, g - 1),
-random_node_(0, N - 1)
+
+blockmodel_t::blockmodel_t(const uint_vec_t & memberships, unsigned int g, unsigned int N, adj_list_t * adj_list_ptr)
 {
+  // N is redundant with the memberships since the vertices are drawn from the rng.
+  assert(N == memberships.size());
+  (void) N;
   memberships_ = memberships;
   adj_list_ptr_ = adj_list_ptr;
+  track_changes_ = false;
   n_.resize(g, 0);
   for (unsigned int j = 0; j < memberships.size(); ++j)
   {
@@ -16,19 +27,19 @@ random_node_(0, N - 1)
 }
 
 
-std::vector<mcmc_move_t> blockmodel_t::single_vertex_change(std::mt19937& engine)
+std::vector<mcmc_move_t> blockmodel_t::single_vertex_change(rng_t& engine)
 {
   std::vector<mcmc_move_t> moves(1);
-  moves[0].vertex = random_node_(engine);
+  moves[0].vertex = engine.uniform_int(get_N());
   moves[0].source = memberships_[moves[0].vertex];
-  moves[0].target = random_block_(engine);
+  moves[0].target = engine.uniform_int(get_g());
   return moves;
 }
-std::vector<mcmc_move_t> blockmodel_t::vertices_swap(std::mt19937& engine)
+std::vector<mcmc_move_t> blockmodel_t::vertices_swap(rng_t& engine)
 {
   std::vector<mcmc_move_t> moves(2);
-  moves[0].vertex = random_node_(engine);
-  moves[1].vertex = random_node_(engine);
+  moves[0].vertex = engine.uniform_int(get_N());
+  moves[1].vertex = engine.uniform_int(get_N());
   moves[0].source = memberships_[moves[0].vertex];
   moves[0].target = memberships_[moves[1].vertex];
   moves[1].source = memberships_[moves[1].vertex];
@@ -36,7 +47,10 @@ std::vector<mcmc_move_t> blockmodel_t::vertices_swap(std::mt19937& engine)
   return moves;
 }
 
-int_vec_t blockmodel_t::get_k(unsigned int vertex) const {return k_[vertex];}
+int_vec_t blockmodel_t::get_k(unsigned int vertex) const
+{
+  return int_vec_t(k_.begin() + vertex * get_g(), k_.begin() + (vertex + 1) * get_g());
+}
 bool blockmodel_t::are_connected(unsigned int vertex_a, unsigned int vertex_b) const
 {
   if (adj_list_ptr_->at(vertex_a).find(vertex_b) != adj_list_ptr_->at(vertex_a).end())
@@ -70,8 +84,9 @@ uint_mat_t blockmodel_t::get_m() const
 unsigned int blockmodel_t::get_N() const {return memberships_.size();}
 unsigned int blockmodel_t::get_g() const {return n_.size();}
 
-void blockmodel_t::apply_mcmc_moves(std::vector<mcmc_move_t> moves)
+void blockmodel_t::apply_mcmc_moves(const std::vector<mcmc_move_t> & moves)
 {
+  const unsigned int g = get_g();
   for (unsigned int i = 0; i < moves.size(); ++i)
   {
         // Change block degrees and block sizes
@@ -79,8 +94,17 @@ void blockmodel_t::apply_mcmc_moves(std::vector<mcmc_move_t> moves)
      neighbour != adj_list_ptr_->at(moves[i].vertex).end();
      ++neighbour)
     {
-      --k_[*neighbour][moves[i].source];
-      ++k_[*neighbour][moves[i].target];
+      --k_[*neighbour * g + moves[i].source];
+      ++k_[*neighbour * g + moves[i].target];
+    }
+    if (track_changes_)
+    {
+      for (auto neighbour = adj_list_ptr_->at(moves[i].vertex).begin();
+       neighbour != adj_list_ptr_->at(moves[i].vertex).end();
+       ++neighbour)
+      {
+        mark_changed(*neighbour);
+      }
     }
     --n_[moves[i].source];
     ++n_[moves[i].target];
@@ -90,22 +114,69 @@ void blockmodel_t::apply_mcmc_moves(std::vector<mcmc_move_t> moves)
 }
 
 
-void blockmodel_t::shuffle(std::mt19937& engine)
+void blockmodel_t::shuffle(rng_t& engine)
 {
   std::shuffle(memberships_.begin(), memberships_.end(), engine);
   compute_k();
 }
 
+void blockmodel_t::set_memberships(const uint_vec_t & memberships)
+{
+  memberships_ = memberships;
+  std::fill(n_.begin(), n_.end(), 0);
+  for (unsigned int j = 0; j < memberships.size(); ++j)
+  {
+    ++n_[memberships[j]];
+  }
+  compute_k();
+}
+
+void blockmodel_t::track_changes(bool enabled)
+{
+  if (enabled == track_changes_) return;
+  track_changes_ = enabled;
+  epoch_.renew();
+  version_.assign(enabled ? get_N() : 0, 0);
+  queued_.assign(enabled ? get_N() : 0, 0);
+  changed_.clear();
+}
+
+bool blockmodel_t::pop_changed(unsigned int & vertex)
+{
+  if (changed_.empty()) return false;
+  vertex = changed_.front();
+  changed_.pop_front();
+  queued_[vertex] = 0;
+  return true;
+}
+
+void blockmodel_t::mark_changed(unsigned int vertex)
+{
+  ++version_[vertex];
+  if (!queued_[vertex])
+  {
+    queued_[vertex] = 1;
+    changed_.push_back(vertex);
+  }
+}
+
 void blockmodel_t::compute_k()
 {
-  k_.clear();
-  k_.resize(adj_list_ptr_->size());
+  epoch_.renew();
+  const unsigned int g = get_g();
+  k_.assign(adj_list_ptr_->size() * g, 0);
   for (unsigned int i = 0; i < adj_list_ptr_->size(); ++i)
   {
-    k_[i].resize(this->n_.size(), 0);
     for (auto nb = adj_list_ptr_->at(i).begin(); nb != adj_list_ptr_->at(i).end(); ++nb)
     {
-      ++k_[i][memberships_[*nb]];
+      ++k_[i * g + memberships_[*nb]];
+    }
+  }
+  if (track_changes_)
+  {
+    for (unsigned int i = 0; i < get_N(); ++i)
+    {
+      mark_changed(i);
     }
   }
 }
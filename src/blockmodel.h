@@ -1,43 +1,75 @@
 #ifndef BLOCKMODEL_H
 #define BLOCKMODEL_H
 
-#include <random>
 #include <utility>
 #include <algorithm> // std::shuffle
 #include <vector>
+#include <deque>
 #include "types.h"
+#include "random.h"
 
 class blockmodel_t {
 public:
   blockmodel_t(const uint_vec_t & memberships, unsigned int g, unsigned int N, adj_list_t * adj_list_ptr);
 
-  std::vector<mcmc_move_t> single_vertex_change(std::mt19937& engine);
-  std::vector<mcmc_move_t> vertices_swap(std::mt19937& engine);
+  std::vector<mcmc_move_t> single_vertex_change(rng_t& engine);
+  std::vector<mcmc_move_t> vertices_swap(rng_t& engine);
 
   int_vec_t get_k(unsigned int vertex) const;
+  /* Contiguous views of the block degrees of a vertex and of the block sizes (g entries each). */
+  const int * get_k_data(unsigned int vertex) const {return &k_[vertex * n_.size()];}
+  const int * get_size_data() const {return n_.data();}
   bool are_connected(unsigned int vertex_a, unsigned int vertex_b) const;
   int_vec_t get_size_vector() const;
   uint_vec_t get_memberships() const;
+  unsigned int get_membership(unsigned int vertex) const {return memberships_[vertex];}
   uint_mat_t get_m() const;
   unsigned int get_N() const;
   unsigned int get_g() const;
+  adj_list_t * get_adj_list_ptr() const {return adj_list_ptr_;}
 
-  void apply_mcmc_moves(std::vector<mcmc_move_t> moves);
+  void apply_mcmc_moves(const std::vector<mcmc_move_t> & moves);
 
-  void shuffle(std::mt19937& engine);
+  void shuffle(rng_t& engine);
+  void set_memberships(const uint_vec_t & memberships);
+
+  /* Change tracking. When enabled, every vertex has a version that changes whenever its
+     block degrees change, and the vertices that changed are queued (once) until popped. */
+  void track_changes(bool enabled);
+  bool is_tracking_changes() const {return track_changes_;}
+  unsigned int get_version(unsigned int vertex) const {return version_[vertex];}
+  /* Pop the vertex that changed the earliest. Returns false if none changed. */
+  bool pop_changed(unsigned int & vertex);
+  /* Identifier of the degrees and versions: it changes whenever they are recomputed or reset,
+     and every blockmodel (copies included) gets its own, so that the versions of two epochs
+     are never compared. */
+  unsigned long get_epoch() const {return epoch_.value;}
 
 private:
+  /* A fresh value at construction, on copy and on renew(). */
+  struct epoch_t
+  {
+    unsigned long value;
+    epoch_t() : value(next()) {}
+    epoch_t(const epoch_t &) : value(next()) {}
+    epoch_t & operator=(const epoch_t &) {value = next(); return *this;}
+    void renew() {value = next();}
+    static unsigned long next();
+  };
     /// State variable
   adj_list_t * adj_list_ptr_;
-  int_mat_t k_;
+  int_vec_t k_;  // block degrees, N x g in row major order
   int_vec_t n_;
   uint_vec_t memberships_;
-    /// Internal distribution. Generator must be passed as a service
-  std::uniform_int_distribution<> random_block_;
-  std::uniform_int_distribution<> random_node_;
+  bool track_changes_;
+  uint_vec_t version_;
+  std::vector<char> queued_;
+  std::deque<unsigned int> changed_;
+  epoch_t epoch_;
     /// Private methods
     /* Compute the degree matrix from scratch. */
   void compute_k();
+  void mark_changed(unsigned int vertex);
 };
 
 #endif // BLOCKMODEL_H
\ No newline at end of file
@@ -0,0 +1,111 @@
+#include "convergence.h"
+
+double autocorrelation_time(const trace_t & trace, double c)
+{
+  unsigned int n = trace.size();
+  if (n < 2) return 1;
+  double mean = 0;
+  for (unsigned int i = 0; i < n; ++i) mean += trace[i];
+  mean /= n;
+  double variance = 0;
+  for (unsigned int i = 0; i < n; ++i) variance += (trace[i] - mean) * (trace[i] - mean);
+  if (variance == 0) return 1;  // constant trace, nothing to correlate
+  double tau = 1;
+  for (unsigned int lag = 1; lag < n; ++lag)
+  {
+    double rho = 0;
+    for (unsigned int i = 0; i + lag < n; ++i)
+    {
+      rho += (trace[i] - mean) * (trace[i + lag] - mean);
+    }
+    tau += 2 * rho / variance;
+    if (lag >= c * tau) break;
+  }
+  return std::max(tau, 1.0);
+}
+
+double effective_sample_size(const trace_t & trace)
+{
+  return trace.size() / autocorrelation_time(trace);
+}
+
+double split_r_hat(const std::vector<trace_t> & chains)
+{
+  // Length of the half chains (the middle entry of odd chains is dropped).
+  unsigned int h = std::numeric_limits<unsigned int>::max();
+  for (auto chain = chains.begin(); chain != chains.end(); ++chain)
+  {
+    h = std::min(h, (unsigned int) chain->size() / 2);
+  }
+  if (chains.empty() || h < 2) return std::numeric_limits<double>::infinity();
+  std::vector<double> means;
+  std::vector<double> variances;
+  for (auto chain = chains.begin(); chain != chains.end(); ++chain)
+  {
+    unsigned int offsets[2] = {0, (unsigned int) chain->size() - h};
+    for (unsigned int half = 0; half < 2; ++half)
+    {
+      double mean = 0;
+      for (unsigned int i = 0; i < h; ++i) mean += chain->at(offsets[half] + i);
+      mean /= h;
+      double variance = 0;
+      for (unsigned int i = 0; i < h; ++i)
+      {
+        variance += (chain->at(offsets[half] + i) - mean) * (chain->at(offsets[half] + i) - mean);
+      }
+      means.push_back(mean);
+      variances.push_back(variance / (h - 1));
+    }
+  }
+  unsigned int m = means.size();
+  double grand_mean = 0;
+  double W = 0;
+  for (unsigned int j = 0; j < m; ++j)
+  {
+    grand_mean += means[j];
+    W += variances[j];
+  }
+  grand_mean /= m;
+  W /= m;
+  double B = 0;  // between-chain variance, times h
+  for (unsigned int j = 0; j < m; ++j)
+  {
+    B += (means[j] - grand_mean) * (means[j] - grand_mean);
+  }
+  B *= (double) h / (m - 1);
+  if (W == 0)
+  {
+    if (B == 0) return 1;
+    return std::numeric_limits<double>::infinity();
+  }
+  double var_plus = (h - 1) * W / h + B / h;
+  return std::sqrt(var_plus / W);
+}
+
+double membership_change(const uint_vec_t & a, const uint_vec_t & b)
+{
+  if (a.empty()) return 0;
+  unsigned int changed = 0;
+  for (unsigned int i = 0; i < a.size(); ++i)
+  {
+    if (a[i] != b[i]) ++changed;
+  }
+  return (double) changed / a.size();
+}
+
+double marginal_change(const uint_mat_t & a, unsigned int samples_a,
+                       const uint_mat_t & b, unsigned int samples_b, double z)
+{
+  if (a.empty() || samples_a == 0 || samples_b == 0) return 0;
+  unsigned int changed = 0;
+  for (unsigned int i = 0; i < a.size(); ++i)
+  {
+    unsigned int r = std::max_element(a[i].begin(), a[i].end()) - a[i].begin();
+    double fa = (double) a[i][r] / samples_a;
+    double fb = (double) b[i][r] / samples_b;
+    double f = (double) (a[i][r] + b[i][r]) / (samples_a + samples_b);
+    double error = std::sqrt(f * (1 - f) * (1. / samples_a + 1. / samples_b));
+    if (fa - fb > z * error) ++changed;
+  }
+  return (double) changed / a.size();
+}
@@ -0,0 +1,40 @@
+#ifndef CONVERGENCE_H
+#define CONVERGENCE_H
+
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include "types.h"
+
+typedef std::vector<double> trace_t;
+
+/* Summary of an adaptive marginalization run. */
+typedef struct convergence_t
+{
+  unsigned int burn_in;             // steps spent in burn-in
+  unsigned int sampling_frequency;  // thinning interval (steps)
+  unsigned int num_samples;
+  double autocorrelation_time;      // of the log-likelihood, in steps
+  double r_hat;                     // split-chain R-hat at the end of burn-in
+  double effective_sample_size;
+  bool converged;                   // false if the step budget ran out
+} convergence_t;
+
+/* Integrated autocorrelation time of a trace, in units of trace entries.
+   Uses Sokal's adaptive window: the sum over lags stops at the first lag M >= c * tau(M). */
+double autocorrelation_time(const trace_t & trace, double c=5);
+/* Effective number of independent entries in a trace. */
+double effective_sample_size(const trace_t & trace);
+/* Split-chain potential scale reduction factor (Gelman et al.).
+   Every chain is split in two halves, which are then compared as separate chains. */
+double split_r_hat(const std::vector<trace_t> & chains);
+/* Fraction of the entries that differ between two membership vectors. */
+double membership_change(const uint_vec_t & a, const uint_vec_t & b);
+/* Fraction of the vertices whose most frequent block in the counts a (of samples_a samples) is less
+   frequent in the counts b by more than z standard errors of the difference of the two frequencies.
+   Vertices that hesitate between blocks do not count as changed because of the sampling noise. */
+double marginal_change(const uint_mat_t & a, unsigned int samples_a,
+                       const uint_mat_t & b, unsigned int samples_b, double z=3);
+
+#endif // CONVERGENCE_H
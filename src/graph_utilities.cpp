@@ -34,4 +34,117 @@ adj_list_t edge_to_adj(const edge_list_t & edge_list, unsigned int num_vertices)
     adj_list[edge->second].insert(edge->first);
   }
   return adj_list;
+}
+
+uint_vec_t compact_vertex_ids(edge_list_t & edge_list, unsigned int num_vertices)
+{
+  uint_vec_t ids;
+  unsigned int max_id = 0;
+  for (auto edge = edge_list.begin(); edge != edge_list.end(); ++edge)
+  {
+    max_id = std::max(max_id, std::max(edge->first, edge->second));
+  }
+  if (edge_list.empty() || max_id < num_vertices)
+  {
+    ids.resize(num_vertices);
+    for (unsigned int i = 0; i < num_vertices; ++i) ids[i] = i;
+    return ids;
+  }
+  for (auto edge = edge_list.begin(); edge != edge_list.end(); ++edge)
+  {
+    ids.push_back(edge->first);
+    ids.push_back(edge->second);
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  for (auto edge = edge_list.begin(); edge != edge_list.end(); ++edge)
+  {
+    edge->first = std::lower_bound(ids.begin(), ids.end(), edge->first) - ids.begin();
+    edge->second = std::lower_bound(ids.begin(), ids.end(), edge->second) - ids.begin();
+  }
+  while (ids.size() < num_vertices)
+  {
+    ids.push_back(++max_id);
+  }
+  return ids;
+}
+
+/* Breadth-first order of the component of root, appended to order. */
+static void bfs_order(const adj_list_t & adj_list, unsigned int root, bool by_degree,
+                      std::vector<bool> & visited, uint_vec_t & order)
+{
+  std::queue<unsigned int> queue;
+  queue.push(root);
+  visited[root] = true;
+  uint_vec_t neighbours;
+  while (!queue.empty())
+  {
+    unsigned int vertex = queue.front();
+    queue.pop();
+    order.push_back(vertex);
+    neighbours.clear();
+    for (auto nb = adj_list[vertex].begin(); nb != adj_list[vertex].end(); ++nb)
+    {
+      if (!visited[*nb]) neighbours.push_back(*nb);
+    }
+    if (by_degree)
+    {
+      std::stable_sort(neighbours.begin(), neighbours.end(),
+                       [&adj_list](unsigned int a, unsigned int b) {return adj_list[a].size() < adj_list[b].size();});
+    }
+    for (auto nb = neighbours.begin(); nb != neighbours.end(); ++nb)
+    {
+      visited[*nb] = true;
+      queue.push(*nb);
+    }
+  }
+}
+
+uint_vec_t vertex_order(const adj_list_t & adj_list, const std::string & method)
+{
+  unsigned int N = adj_list.size();
+  uint_vec_t order;
+  if (method == "none" || method == "degree")
+  {
+    order.resize(N);
+    for (unsigned int i = 0; i < N; ++i) order[i] = i;
+    if (method == "degree")
+    {
+      std::stable_sort(order.begin(), order.end(),
+                       [&adj_list](unsigned int a, unsigned int b) {return adj_list[a].size() > adj_list[b].size();});
+    }
+  }
+  else if (method == "bfs" || method == "rcm")
+  {
+    // Cuthill-McKee starts every component from one of its vertices of minimal degree.
+    uint_vec_t roots(N);
+    for (unsigned int i = 0; i < N; ++i) roots[i] = i;
+    if (method == "rcm")
+    {
+      std::stable_sort(roots.begin(), roots.end(),
+                       [&adj_list](unsigned int a, unsigned int b) {return adj_list[a].size() < adj_list[b].size();});
+    }
+    std::vector<bool> visited(N, false);
+    for (auto root = roots.begin(); root != roots.end(); ++root)
+    {
+      if (!visited[*root]) bfs_order(adj_list, *root, method == "rcm", visited, order);
+    }
+    if (method == "rcm") std::reverse(order.begin(), order.end());
+  }
+  return order;
+}
+
+adj_list_t permute_adj(const adj_list_t & adj_list, const uint_vec_t & order)
+{
+  uint_vec_t position(order.size());
+  for (unsigned int i = 0; i < order.size(); ++i) position[order[i]] = i;
+  adj_list_t permuted(adj_list.size());
+  for (unsigned int i = 0; i < order.size(); ++i)
+  {
+    for (auto nb = adj_list[order[i]].begin(); nb != adj_list[order[i]].end(); ++nb)
+    {
+      permuted[i].insert(position[*nb]);
+    }
+  }
+  return permuted;
 }
\ No newline at end of file
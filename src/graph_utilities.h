@@ -4,11 +4,23 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <queue>
 #include "types.h"
 
 /* Load an edge list. Result passed by reference. Returns true on success. */
 bool load_edge_list(edge_list_t & edge_list, const std::string edge_list_path);
 /* Convert adjacency list to edge list. Result passed by reference. */
 adj_list_t edge_to_adj(const edge_list_t & edge_list, unsigned int num_vertices=0);
+/* Relabel the vertices with contiguous identifiers if some identifiers are >= num_vertices.
+   The new identifiers follow the order of the original ones; vertices without edges are appended
+   with identifiers after the largest one. Returns the original identifier of every vertex. */
+uint_vec_t compact_vertex_ids(edge_list_t & edge_list, unsigned int num_vertices);
+/* Vertex order improving the locality of neighbour walks. Methods are none, bfs, rcm (reverse
+   Cuthill-McKee) and degree (decreasing). order[i] is the vertex placed at position i.
+   Returns an empty order for unknown methods. */
+uint_vec_t vertex_order(const adj_list_t & adj_list, const std::string & method);
+/* Adjacency list of the graph where vertex order[i] is renamed i. */
+adj_list_t permute_adj(const adj_list_t & adj_list, const uint_vec_t & order);
 
 #endif // GRAPH_UTILITIES_H
\ No newline at end of file
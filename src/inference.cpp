@@ -0,0 +1,491 @@
+#include "inference.h"
+
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+#include <sstream>
+#include <thread>
+#include "blockmodel.h"
+#include "marginal.h"
+#include "metropolis_hasting.h"
+#include "graph_utilities.h"
+#include "random.h"
+
+float_mat_t probability_matrix(const float_vec_t & probabilities, unsigned int g, bool use_ppm)
+{
+  float_mat_t p(g, float_vec_t(g, 0));
+  if (!use_ppm)
+  {
+    for (unsigned int r = 0; r < g; ++r)
+    {
+      for (unsigned int s = 0; s < g; ++s)
+      {
+        p[r][s] = probabilities[s + r*g];
+      }
+    }
+  }
+  else
+  {
+    for (unsigned int r = 0; r < g; ++r)
+    {
+      p[r][r] = probabilities[0];
+      for (unsigned int s = r + 1; s < g; ++s)
+      {
+        p[r][s] = probabilities[1];
+        p[s][r] = probabilities[1];
+      }
+    }
+  }
+  return p;
+}
+
+float_vec_t default_cooling_schedule_kwargs(const std::string & cooling_schedule, unsigned int duration)
+{
+  float_vec_t kwargs(2, 0);
+  if (cooling_schedule == "exponential")
+  {
+    kwargs[0] = 1;
+    kwargs[1] = 0.99;
+  }
+  if (cooling_schedule == "linear")
+  {
+    kwargs[0] = duration + 1;
+    kwargs[1] = 1;
+  }
+  if (cooling_schedule == "logarithmic")
+  {
+    kwargs[0] = 1;
+    kwargs[1] = 1;
+  }
+  if (cooling_schedule == "constant")
+  {
+    kwargs[0] = 1;
+  }
+  if (cooling_schedule == "adaptive")
+  {
+    kwargs[0] = 1;
+    kwargs[1] = 0.95;
+  }
+  return kwargs;
+}
+
+static bool check_cooling_schedule(const std::string & cooling_schedule,
+                                   const float_vec_t & kwargs,
+                                   unsigned int duration,
+                                   std::string & error)
+{
+  std::ostringstream message;
+  if (get_cooling_schedule(cooling_schedule) == nullptr && cooling_schedule != "adaptive")
+  {
+    error = "Invalid cooling schedule. Options are exponential, linear, logarithmic, constant and adaptive.\n";
+    return false;
+  }
+  unsigned int expected = (cooling_schedule == "constant") ? 1 : 2;
+  if (kwargs.size() < expected)
+  {
+    message << "The " << cooling_schedule << " schedule takes " << expected << " arguments.\n";
+    error = message.str();
+    return false;
+  }
+  if (cooling_schedule == "exponential")
+  {
+    if (kwargs[0] <= 0)
+    {
+      message << "Invalid cooling schedule argument for exponential schedule: T_0 must be grater than 0.\n";
+      message << "Passed value: T_0=" << kwargs[0] << "\n";
+    }
+    else if (kwargs[1] <= 0 || kwargs[1] >= 1)
+    {
+      message << "Invalid cooling schedule argument for exponential schedule: alpha must be in ]0,1[.\n";
+      message << "Passed value: alpha=" << kwargs[1] << "\n";
+    }
+  }
+  else if (cooling_schedule == "linear")
+  {
+    if (kwargs[0] <= 0)
+    {
+      message << "Invalid cooling schedule argument for linear schedule: T_0 must be grater than 0.\n";
+      message << "Passed value: T_0=" << kwargs[0] << "\n";
+    }
+    else if (kwargs[1] <= 0 || kwargs[1] > kwargs[0])
+    {
+      message << "Invalid cooling schedule argument for linear schedule: eta must be in ]0, T_0].\n";
+      message << "Passed value: T_0=" << kwargs[0] << ", eta=" << kwargs[1] << "\n";
+    }
+    else if (kwargs[1] * duration > kwargs[0])
+    {
+      message << "Invalid cooling schedule argument for linear schedule: eta * sampling_steps must be smaller or equal to T_0.\n";
+      message << "Passed value: eta*sampling_steps=" << kwargs[1] * duration << ", T_0=" << kwargs[0] << "\n";
+    }
+  }
+  else if (cooling_schedule == "logarithmic")
+  {
+    if (kwargs[0] <= 0)
+    {
+      message << "Invalid cooling schedule argument for logarithmic schedule: c must be greater than 0.\n";
+      message << "Passed value: c=" << kwargs[0] << "\n";
+    }
+    else if (kwargs[1] <= 0)
+    {
+      message << "Invalid cooling schedule argument for logarithmic schedule: d must be greater than 0.\n";
+      message << "Passed value: d=" << kwargs[1] << "\n";
+    }
+  }
+  else if (cooling_schedule == "constant")
+  {
+    if (kwargs[0] <= 0)
+    {
+      message << "Invalid cooling schedule argument for constant schedule: temperature must be greater than 0.\n";
+      message << "Passed value: T=" << kwargs[0] << "\n";
+    }
+  }
+  else if (cooling_schedule == "adaptive")
+  {
+    if (kwargs[0] <= 0)
+    {
+      message << "Invalid cooling schedule argument for adaptive schedule: T_0 must be greater than 0.\n";
+      message << "Passed value: T_0=" << kwargs[0] << "\n";
+    }
+    else if (kwargs[1] <= 0 || kwargs[1] >= 1)
+    {
+      message << "Invalid cooling schedule argument for adaptive schedule: alpha must be in ]0,1[.\n";
+      message << "Passed value: alpha=" << kwargs[1] << "\n";
+    }
+  }
+  error = message.str();
+  return error.empty();
+}
+
+bool check_parameters(const inference_parameters_t & parameters, std::string & error)
+{
+  unsigned int g = parameters.n.size();
+  if (g == 0)
+  {
+    error = "At least one block is required.\n";
+    return false;
+  }
+  if (g > 65536)
+  {
+    error = "At most 65536 blocks are supported.\n";
+    return false;
+  }
+  if (parameters.p.size() != g)
+  {
+    error = "The probability matrix must be g x g.\n";
+    return false;
+  }
+  for (unsigned int r = 0; r < g; ++r)
+  {
+    if (parameters.p[r].size() != g)
+    {
+      error = "The probability matrix must be g x g.\n";
+      return false;
+    }
+  }
+  if (make_rng(parameters.rng, 0) == nullptr)
+  {
+    error = "Invalid random number generator. Options are xoshiro256 and mt19937.\n";
+    return false;
+  }
+  if (parameters.reorder != "none" && parameters.reorder != "bfs" &&
+      parameters.reorder != "rcm" && parameters.reorder != "degree")
+  {
+    error = "Invalid vertex reordering. Options are none, bfs, rcm and degree.\n";
+    return false;
+  }
+  if (parameters.multiple_tries == 0)
+  {
+    error = "multiple_tries must be greater than 0.\n";
+    return false;
+  }
+  if (parameters.score_cache && parameters.use_ppm)
+  {
+    error = "The score cache replaces the SBM ratios and cannot be combined with the PPM ratios.\n";
+    return false;
+  }
+  if (parameters.sequential_degree > 0 && !parameters.use_single_vertex)
+  {
+    error = "The sequential test requires single vertex proposals.\n";
+    return false;
+  }
+  if (parameters.sequential_tolerance < 0 || parameters.sequential_tolerance > 1)
+  {
+    error = "sequential_tolerance must be in [0,1].\n";
+    return false;
+  }
+  if (parameters.score_cache || parameters.multiple_tries > 1 || parameters.sequential_degree > 0)
+  {
+    for (unsigned int r = 0; r < g; ++r)
+    {
+      for (unsigned int s = 0; s < g; ++s)
+      {
+        if (!(parameters.p[r][s] > 0 && parameters.p[r][s] < 1))
+        {
+          error = "The score cache, multiple tries and sequential test require probabilities strictly between 0 and 1.\n";
+          return false;
+        }
+      }
+    }
+  }
+  if (!parameters.maximize && !parameters.adaptive && parameters.sampling_frequency == 0)
+  {
+    error = "sampling_frequency must be greater than 0.\n";
+    return false;
+  }
+  const inference_parameters_t defaults;
+  if ((!parameters.maximize || parameters.cooling_schedule != "adaptive") &&
+      (parameters.patience != defaults.patience || parameters.restarts != defaults.restarts ||
+       parameters.perturbation != defaults.perturbation))
+  {
+    error = "patience, restarts and perturbation require the adaptive cooling schedule.\n";
+    return false;
+  }
+  if (parameters.maximize)
+  {
+    float_vec_t kwargs = parameters.cooling_schedule_kwargs;
+    if (kwargs.empty())
+    {
+      kwargs = default_cooling_schedule_kwargs(parameters.cooling_schedule, parameters.sampling_steps);
+    }
+    if (parameters.perturbation < 0 || parameters.perturbation > 1)
+    {
+      error = "perturbation must be in [0,1].\n";
+      return false;
+    }
+    return check_cooling_schedule(parameters.cooling_schedule, kwargs, parameters.sampling_steps, error);
+  }
+  return true;
+}
+
+/* Adaptive annealing, followed by restarts in parallel from perturbations of the best state.
+   The blockmodel is left in the best state found. The decisions of the sequential tests of the
+   restarts are added to early_decisions and approximate_decisions. */
+static void anneal_with_restarts(blockmodel_t & blockmodel,
+                                 metropolis_hasting & algorithm,
+                                 const inference_parameters_t & parameters,
+                                 const float_vec_t & kwargs,
+                                 rng_t & engine,
+                                 unsigned long & early_decisions,
+                                 unsigned long & approximate_decisions)
+{
+  double best_log_likelihood = algorithm.anneal_adaptive(blockmodel, parameters.p, kwargs[0], kwargs[1],
+                                                         parameters.patience, parameters.sampling_steps, engine);
+  if (parameters.restarts == 0) return;
+  const uint_vec_t best_memberships = blockmodel.get_memberships();
+  const unsigned int g = blockmodel.get_g();
+  const unsigned int N = blockmodel.get_N();
+  adj_list_t * adj_list_ptr = blockmodel.get_adj_list_ptr();
+  std::vector<uint_vec_t> memberships(parameters.restarts);
+  std::vector<double> log_likelihoods(parameters.restarts);
+  std::vector<unsigned long> early(parameters.restarts);
+  std::vector<unsigned long> approximate(parameters.restarts);
+  // A pool of at most one worker per hardware thread, which take the restarts in turn.
+  std::atomic<unsigned int> next_restart(0);
+  unsigned int workers = std::min(parameters.restarts, std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::thread> threads;
+  for (unsigned int w = 0; w < workers; ++w)
+  {
+    threads.push_back(std::thread([&]()
+    {
+      for (unsigned int i = next_restart++; i < parameters.restarts; i = next_restart++)
+      {
+        // Every restart has its own stream, state and algorithm.
+        std::unique_ptr<rng_t> restart_engine = make_rng(parameters.rng, parameters.seed, i + 1);
+        blockmodel_t restart(best_memberships, g, N, adj_list_ptr);
+        // Perturbation by random swaps, which preserve the block sizes.
+        unsigned int swaps = std::ceil(parameters.perturbation * N / 2);
+        for (unsigned int j = 0; j < swaps; ++j)
+        {
+          restart.apply_mcmc_moves(restart.vertices_swap(*restart_engine));
+        }
+        std::shared_ptr<metropolis_hasting> restart_algorithm = make_algorithm(parameters.use_ppm,
+                                                                               parameters.use_single_vertex, g,
+                                                                               parameters.score_cache, true);
+        restart_algorithm->set_multiple_tries(parameters.multiple_tries);
+        restart_algorithm->set_sequential_test(parameters.sequential_degree, parameters.sequential_tolerance);
+        restart_algorithm->set_telemetry(parameters.telemetry, i + 1);
+        log_likelihoods[i] = restart_algorithm->anneal_adaptive(restart, parameters.p, kwargs[0], kwargs[1],
+                                                                parameters.patience, parameters.sampling_steps,
+                                                                *restart_engine);
+        memberships[i] = restart.get_memberships();
+        early[i] = restart_algorithm->get_early_decisions();
+        approximate[i] = restart_algorithm->get_approximate_decisions();
+      }
+    }));
+  }
+  for (auto thread = threads.begin(); thread != threads.end(); ++thread)
+  {
+    thread->join();
+  }
+  for (unsigned int i = 0; i < parameters.restarts; ++i)
+  {
+    early_decisions += early[i];
+    approximate_decisions += approximate[i];
+    if (log_likelihoods[i] > best_log_likelihood)
+    {
+      best_log_likelihood = log_likelihoods[i];
+      blockmodel.set_memberships(memberships[i]);
+    }
+  }
+}
+
+/* Values indexed by the reordered vertices, put back in the original order. */
+template<typename T>
+static std::vector<T> to_original_order(const std::vector<T> & values, const uint_vec_t & order)
+{
+  std::vector<T> original(values.size());
+  for (unsigned int i = 0; i < order.size(); ++i)
+  {
+    original[order[i]] = values[i];
+  }
+  return original;
+}
+
+bool infer(const edge_list_t & edge_list,
+           const inference_parameters_t & parameters,
+           inference_result_t & result,
+           std::string & error)
+{
+  if (!check_parameters(parameters, error)) return false;
+  std::unique_ptr<rng_t> engine = make_rng(parameters.rng, parameters.seed);
+  // number of blocks
+  unsigned int g = parameters.n.size();
+  // number of vertices
+  unsigned int N = 0;
+  for (unsigned int r = 0; r < g; ++r)
+  {
+    N += parameters.n[r];
+  }
+  // Graph structure, with contiguous vertex identifiers
+  edge_list_t compact_edge_list = edge_list;
+  result.vertex_ids = compact_vertex_ids(compact_edge_list, N);
+  if (result.vertex_ids.size() != N)
+  {
+    std::ostringstream message;
+    message << "The edge list has " << result.vertex_ids.size()
+            << " vertices but the block sizes sum to " << N << ".\n";
+    error = message.str();
+    return false;
+  }
+  adj_list_t adj_list = edge_to_adj(compact_edge_list, N);
+  compact_edge_list.clear();
+  // The sampler works on reordered vertices; order[i] is the vertex at position i.
+  uint_vec_t order = vertex_order(adj_list, parameters.reorder);
+  bool reordered = parameters.reorder != "none";
+  if (reordered)
+  {
+    adj_list = permute_adj(adj_list, order);
+  }
+  // memberships from block sizes
+  uint_vec_t memberships_init(N, 0);
+  {
+    unsigned int shift = 0;
+    for (unsigned int r = 0; r < g; ++r)
+    {
+      for (unsigned int i = 0; i < parameters.n[r]; ++i)
+      {
+        memberships_init[shift + i] = r;
+      }
+      shift += parameters.n[r];
+    }
+  }
+  if (reordered)
+  {
+    uint_vec_t memberships_reordered(N);
+    for (unsigned int i = 0; i < N; ++i) memberships_reordered[i] = memberships_init[order[i]];
+    memberships_init = memberships_reordered;
+  }
+  // blockmodel
+  blockmodel_t blockmodel(memberships_init, g, N, &adj_list);
+  if (parameters.randomize)
+  {
+    blockmodel.shuffle(*engine);
+  }
+  // Bind proper Metropolis-Hasting algorithm
+  std::shared_ptr<metropolis_hasting> algorithm = make_algorithm(parameters.use_ppm, parameters.use_single_vertex, g,
+                                                                 parameters.score_cache, parameters.maximize);
+  algorithm->set_multiple_tries(parameters.multiple_tries);
+  algorithm->set_sequential_test(parameters.sequential_degree, parameters.sequential_tolerance);
+  algorithm->set_telemetry(parameters.telemetry);
+  if (reordered && parameters.history)
+  {
+    history_callback_t history = parameters.history;
+    algorithm->set_history([history, order](const uint_vec_t & memberships)
+                           {history(to_original_order(memberships, order));});
+  }
+  else
+  {
+    algorithm->set_history(parameters.history);
+  }
+
+  result.marginal.clear();
+  result.num_samples = 0;
+  result.acceptance_ratio = 0;
+  result.convergence = convergence_t();
+  result.early_decisions = 0;
+  result.approximate_decisions = 0;
+  const inference_parameters_t defaults;
+  if ((!parameters.maximize || parameters.cooling_schedule != "adaptive") &&
+      (parameters.patience != defaults.patience || parameters.restarts != defaults.restarts ||
+       parameters.perturbation != defaults.perturbation))
+  {
+    error = "patience, restarts and perturbation require the adaptive cooling schedule.\n";
+    return false;
+  }
+  if (parameters.maximize)
+  {
+    float_vec_t kwargs = parameters.cooling_schedule_kwargs;
+    if (kwargs.empty())
+    {
+      kwargs = default_cooling_schedule_kwargs(parameters.cooling_schedule, parameters.sampling_steps);
+    }
+    if (parameters.cooling_schedule == "adaptive")
+    {
+      anneal_with_restarts(blockmodel, *algorithm, parameters, kwargs, *engine,
+                           result.early_decisions, result.approximate_decisions);
+    }
+    else
+    {
+      algorithm->anneal(blockmodel, parameters.p, get_cooling_schedule(parameters.cooling_schedule),
+                        kwargs, parameters.sampling_steps, *engine);
+    }
+    result.memberships = blockmodel.get_memberships();
+  }
+  else
+  {
+    marginal_accumulator_t marginal(N, parameters.p, parameters.use_single_vertex ? uint_vec_t() : parameters.n);
+    if (parameters.adaptive)
+    {
+      result.acceptance_ratio = algorithm->marginalize_adaptive(blockmodel, marginal, parameters.p,
+                                                                parameters.burn_in, parameters.sampling_steps,
+                                                                parameters.target_ess,
+                                                                parameters.r_hat_threshold,
+                                                                parameters.stability_threshold,
+                                                                result.convergence, *engine);
+      if (result.convergence.num_samples == 0)
+      {
+        error = "The step budget ran out during the burn-in: no sample was taken. Increase sampling_steps.\n";
+        return false;
+      }
+    }
+    else
+    {
+      result.acceptance_ratio = algorithm->marginalize(blockmodel, marginal, parameters.p, parameters.burn_in,
+                                                       parameters.sampling_frequency, parameters.sampling_steps,
+                                                       *engine);
+    }
+    result.memberships = marginal.argmax();
+    result.marginal = marginal.get_counts();
+    result.num_samples = marginal.get_num_samples();
+  }
+  result.early_decisions += algorithm->get_early_decisions();
+  result.approximate_decisions += algorithm->get_approximate_decisions();
+  blockmodel_t final_state(result.memberships, g, N, &adj_list);
+  result.log_likelihood = log_likelihood(final_state, parameters.p);
+  if (reordered)
+  {
+    result.memberships = to_original_order(result.memberships, order);
+    if (!result.marginal.empty()) result.marginal = to_original_order(result.marginal, order);
+  }
+  return true;
+}
@@ -0,0 +1,72 @@
+#ifndef INFERENCE_H
+#define INFERENCE_H
+
+/* In-process API of the SBM sampler.
+   Runs a whole marginalization or maximization on an in-memory graph, without
+   touching files or the standard streams. */
+
+#include <string>
+#include "types.h"
+#include "convergence.h"
+#include "telemetry.h"
+
+typedef struct inference_parameters_t
+{
+  float_mat_t p;                    // g x g probability matrix
+  uint_vec_t n;                     // block sizes, sum to the number of vertices
+  bool use_ppm = false;             // PPM transition ratios (p must then be of the PPM form)
+  bool use_single_vertex = false;   // single vertex proposals instead of vertices swaps
+  bool randomize = false;           // shuffle the initial memberships
+  bool maximize = false;            // simulated annealing instead of marginalization
+  bool score_cache = false;         // cache the move scores of the vertices (0 < p < 1)
+  unsigned int multiple_tries = 1;  // candidates per step, multiple-try Metropolis if > 1 (0 < p < 1)
+  unsigned int sequential_degree = 0;  // sequential test for the vertices of at least this degree, 0 disables (0 < p < 1)
+  double sequential_tolerance = 0;  // error allowed on the acceptance probabilities of the sequential test
+    /// Marginalization
+  unsigned int burn_in = 1000;
+  unsigned int sampling_steps = 1000;  // also the duration of the annealing
+  unsigned int sampling_frequency = 10;
+  bool adaptive = false;
+  unsigned int target_ess = 200;
+  double r_hat_threshold = 1.05;
+  double stability_threshold = 0.05;
+    /// Maximization
+  std::string cooling_schedule = "exponential";
+  float_vec_t cooling_schedule_kwargs;  // defaults of the schedule if empty
+  unsigned int patience = 20;       // adaptive schedule: sweeps without improvement before stopping
+  unsigned int restarts = 0;        // adaptive schedule: parallel restarts from the best state
+  double perturbation = 0.1;        // adaptive schedule: fraction of the vertices moved before a restart
+    /// Misc.
+  unsigned int seed = 0;
+  std::string reorder = "none";     // vertex order of the sampler: none, bfs, rcm or degree
+  std::string rng = "xoshiro256";   // or mt19937, which reproduces the runs of earlier versions
+  history_callback_t history;       // called with every sample (marginalization) or step (maximization)
+  telemetry_t * telemetry = nullptr;  // receives the snapshots of the chains when requested, owned by the caller
+} inference_parameters_t;
+
+typedef struct inference_result_t
+{
+  uint_vec_t memberships;       // final state (maximization) or most likely blocks (marginalization)
+  uint_mat_t marginal;          // aligned sample counts of every vertex and block (marginalization)
+  uint_vec_t vertex_ids;        // identifier of every vertex in the edge list
+  unsigned int num_samples;
+  double acceptance_ratio;      // marginalization only
+  double log_likelihood;        // of the memberships
+  convergence_t convergence;    // adaptive marginalization only
+  unsigned long early_decisions;        // sequential test decisions taken before all the terms were computed
+  unsigned long approximate_decisions;  // of which decisions within the tolerance, possibly wrong
+} inference_result_t;
+
+/* Probability matrix from a row major list of probabilities, or from (p_in, p_out) with use_ppm. */
+float_mat_t probability_matrix(const float_vec_t & probabilities, unsigned int g, bool use_ppm);
+/* Default arguments of a cooling schedule for an annealing of the given duration. */
+float_vec_t default_cooling_schedule_kwargs(const std::string & cooling_schedule, unsigned int duration);
+/* Check the parameters. Returns false and explains why in error if they are invalid. */
+bool check_parameters(const inference_parameters_t & parameters, std::string & error);
+/* Run the inference. Returns false and explains why in error if it could not be run. */
+bool infer(const edge_list_t & edge_list,
+           const inference_parameters_t & parameters,
+           inference_result_t & result,
+           std::string & error);
+
+#endif // INFERENCE_H
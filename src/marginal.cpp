@@ -0,0 +1,350 @@
+#include "marginal.h"
+
+uint_vec_t maximum_weight_matching(const uint_mat_t & weights, std::vector<long long> * potentials)
+{
+  // Minimizes the cost -weights with row and column potentials.
+  // Rows and columns are 1-indexed; column 0 is a sentinel.
+  unsigned int n = weights.size();
+  const long long inf = std::numeric_limits<long long>::max();
+  std::vector<long long> u(n + 1, 0);
+  std::vector<long long> v(n + 1, 0);
+  uint_vec_t match(n + 1, 0);  // row matched to every column
+  uint_vec_t way(n + 1, 0);
+  for (unsigned int i = 1; i <= n; ++i)
+  {
+    match[0] = i;
+    unsigned int j0 = 0;
+    std::vector<long long> min_v(n + 1, inf);
+    std::vector<bool> used(n + 1, false);
+    do
+    {
+      used[j0] = true;
+      unsigned int i0 = match[j0];
+      unsigned int j1 = 0;
+      long long delta = inf;
+      for (unsigned int j = 1; j <= n; ++j)
+      {
+        if (!used[j])
+        {
+          long long reduced_cost = -(long long) weights[i0 - 1][j - 1] - u[i0] - v[j];
+          if (reduced_cost < min_v[j])
+          {
+            min_v[j] = reduced_cost;
+            way[j] = j0;
+          }
+          if (min_v[j] < delta)
+          {
+            delta = min_v[j];
+            j1 = j;
+          }
+        }
+      }
+      for (unsigned int j = 0; j <= n; ++j)
+      {
+        if (used[j])
+        {
+          u[match[j]] += delta;
+          v[j] -= delta;
+        }
+        else
+        {
+          min_v[j] -= delta;
+        }
+      }
+      j0 = j1;
+    } while (match[j0] != 0);
+    // Augment along the alternating path.
+    do
+    {
+      unsigned int j1 = way[j0];
+      match[j0] = match[j1];
+      j0 = j1;
+    } while (j0 != 0);
+  }
+  uint_vec_t assignment(n, 0);
+  for (unsigned int j = 1; j <= n; ++j)
+  {
+    assignment[match[j] - 1] = j - 1;
+  }
+  if (potentials != nullptr)
+  {
+    // u_i + v_j <= -w_ij, so (-u_i) + (-v_j) >= w_ij.
+    potentials->assign(n, 0);
+    for (unsigned int j = 1; j <= n; ++j) (*potentials)[j - 1] = -v[j];
+  }
+  return assignment;
+}
+
+
+marginal_accumulator_t::marginal_accumulator_t(unsigned int N, const float_mat_t & p, const uint_vec_t & sizes) :
+N_(N),
+g_(p.size()),
+dense_(p.size() * sizeof(std::uint16_t) <= inline_entries * sizeof(entry_t)),
+counts_(dense_ ? (std::size_t) N * p.size() : 0, 0),
+entries_(dense_ ? 0 : (std::size_t) N * inline_entries, entry_t{0, 0}),
+num_samples_(0),
+p_(p),
+sizes_(sizes),
+classes_(p.size(), 0),
+overlap_(p.size(), uint_vec_t(p.size(), 0)),
+permutation_(p.size(), 0)
+{
+  for (unsigned int r = 0; r < g_; ++r)
+  {
+    permutation_[r] = r;
+  }
+  // Colour refinement: two blocks exchanged by a symmetry of p end up in the same class.
+  // The converse does not always hold, hence the check of the matched permutations.
+  unsigned int num_classes = 0;
+  while (true)
+  {
+    std::map<std::vector<double>, unsigned int> ids;
+    uint_vec_t classes(g_, 0);
+    for (unsigned int r = 0; r < g_; ++r)
+    {
+      std::vector< std::pair<double, unsigned int> > neighbours;
+      for (unsigned int s = 0; s < g_; ++s)
+      {
+        if (s != r) neighbours.push_back(std::make_pair(p_[r][s], classes_[s]));
+      }
+      std::sort(neighbours.begin(), neighbours.end());
+      std::vector<double> key = {(double) classes_[r], p_[r][r], sizes_.empty() ? 0. : sizes_[r]};
+      for (auto neighbour = neighbours.begin(); neighbour != neighbours.end(); ++neighbour)
+      {
+        key.push_back(neighbour->first);
+        key.push_back(neighbour->second);
+      }
+      classes[r] = ids.insert(std::make_pair(key, (unsigned int) ids.size())).first->second;
+    }
+    classes_ = classes;
+    if (ids.size() == num_classes) break;
+    num_classes = ids.size();
+  }
+}
+
+bool marginal_accumulator_t::is_symmetry(const uint_vec_t & permutation) const
+{
+  for (unsigned int r = 0; r < g_; ++r)
+  {
+    if (!sizes_.empty() && sizes_[permutation[r]] != sizes_[r]) return false;
+    for (unsigned int s = 0; s < g_; ++s)
+    {
+      if (p_[permutation[r]][permutation[s]] != p_[r][s]) return false;
+    }
+  }
+  return true;
+}
+
+unsigned int marginal_accumulator_t::weight(unsigned int s, unsigned int r) const
+{
+  // Any pair of the same class outweighs all the overlaps, so that a match never crosses classes.
+  return (classes_[s] == classes_[r]) ? overlap_[s][r] + N_ + 1 : 0;
+}
+
+bool marginal_accumulator_t::is_still_optimal() const
+{
+  // The weight of the permutation reaches the upper bound given by the potentials of the last match.
+  if (potentials_.empty()) return false;
+  long long bound = 0;
+  long long matched = 0;
+  for (unsigned int s = 0; s < g_; ++s)
+  {
+    long long row = std::numeric_limits<long long>::min();
+    for (unsigned int r = 0; r < g_; ++r)
+    {
+      row = std::max(row, (long long) weight(s, r) - potentials_[r]);
+    }
+    bound += row + potentials_[s];
+    matched += weight(s, permutation_[s]);
+  }
+  return matched == bound;
+}
+
+void marginal_accumulator_t::add(const uint_vec_t & memberships)
+{
+  if (reference_.empty())
+  {
+    reference_.assign(memberships.begin(), memberships.end());
+    previous_ = reference_;
+    for (unsigned int i = 0; i < memberships.size(); ++i)
+    {
+      ++overlap_[memberships[i]][memberships[i]];
+    }
+  }
+  else
+  {
+    bool changed = false;
+    const unsigned int * labels = memberships.data();
+    std::uint16_t * previous = previous_.data();
+    // Few vertices change between samples: compare by chunks first, without branches.
+    for (unsigned int begin = 0; begin < N_; begin += 64)
+    {
+      unsigned int end = std::min(begin + 64, N_);
+      unsigned int differ = 0;
+      for (unsigned int i = begin; i < end; ++i) differ |= labels[i] ^ previous[i];
+      if (differ == 0) continue;
+      for (unsigned int i = begin; i < end; ++i)
+      {
+        if (labels[i] != previous[i])
+        {
+          --overlap_[previous[i]][reference_[i]];
+          ++overlap_[labels[i]][reference_[i]];
+          previous[i] = labels[i];
+        }
+      }
+      changed = true;
+    }
+    if (changed && !is_still_optimal())
+    {
+      uint_mat_t weights(g_, uint_vec_t(g_, 0));
+      for (unsigned int s = 0; s < g_; ++s)
+      {
+        for (unsigned int r = 0; r < g_; ++r) weights[s][r] = weight(s, r);
+      }
+      uint_vec_t permutation = maximum_weight_matching(weights, &potentials_);
+      if (is_symmetry(permutation)) permutation_ = permutation;
+      else potentials_.clear();
+    }
+  }
+  const unsigned int * labels = memberships.data();
+  const unsigned int * permutation = permutation_.data();
+  if (dense_)
+  {
+    std::uint16_t * row = counts_.data();
+    unsigned int g = g_;
+    for (unsigned int i = 0; i < N_; ++i, row += g)
+    {
+      std::uint16_t & low = row[permutation[labels[i]]];
+      if (++low == 0) overflow(i, permutation[labels[i]], low);
+    }
+  }
+  else
+  {
+    for (unsigned int i = 0; i < N_; ++i)
+    {
+      std::uint16_t & low = counter(i, permutation[labels[i]]);
+      if (++low == 0) overflow(i, permutation[labels[i]], low);
+    }
+  }
+  ++num_samples_;
+}
+
+void marginal_accumulator_t::overflow(unsigned int vertex, unsigned int block, std::uint16_t & low)
+{
+  // Wrap to 1 rather than 0, which marks the blocks never visited.
+  low = 1;
+  ++carry_[(unsigned long long) vertex * g_ + block];
+}
+
+std::uint16_t & marginal_accumulator_t::counter(unsigned int vertex, unsigned int block)
+{
+  if (dense_) return counts_[(std::size_t) vertex * g_ + block];
+  entry_t * row = &entries_[(std::size_t) vertex * inline_entries];
+  if (row[inline_entries - 1].count == 0 || spilled_.empty() || spilled_.count(vertex) == 0)
+  {
+    for (unsigned int e = 0; e < inline_entries; ++e)
+    {
+      if (row[e].count == 0) row[e].block = block;
+      if (row[e].block == block) return row[e].count;
+    }
+    // Spill the row to a dense one at the end of the pool.
+    std::size_t offset = counts_.size();
+    counts_.resize(offset + g_, 0);
+    for (unsigned int e = 0; e < inline_entries; ++e)
+    {
+      counts_[offset + row[e].block] = row[e].count;
+    }
+    spilled_[vertex] = offset;
+    return counts_[offset + block];
+  }
+  return counts_[spilled_.find(vertex)->second + block];
+}
+
+const std::uint16_t * marginal_accumulator_t::find(unsigned int vertex, unsigned int block) const
+{
+  if (dense_) return &counts_[(std::size_t) vertex * g_ + block];
+  const entry_t * row = &entries_[(std::size_t) vertex * inline_entries];
+  if (row[inline_entries - 1].count != 0 && !spilled_.empty())
+  {
+    auto spilled = spilled_.find(vertex);
+    if (spilled != spilled_.end()) return &counts_[spilled->second + block];
+  }
+  for (unsigned int e = 0; e < inline_entries && row[e].count != 0; ++e)
+  {
+    if (row[e].block == block) return &row[e].count;
+  }
+  return nullptr;
+}
+
+void marginal_accumulator_t::clear()
+{
+  if (dense_)
+  {
+    std::fill(counts_.begin(), counts_.end(), 0);
+  }
+  else
+  {
+    std::fill(entries_.begin(), entries_.end(), entry_t{0, 0});
+    counts_.clear();
+    spilled_.clear();
+  }
+  carry_.clear();
+  num_samples_ = 0;
+}
+
+unsigned int marginal_accumulator_t::count(unsigned int vertex, unsigned int block) const
+{
+  const std::uint16_t * low = find(vertex, block);
+  if (low == nullptr || *low == 0) return 0;
+  unsigned int high = 0;
+  if (!carry_.empty())
+  {
+    auto carry = carry_.find((unsigned long long) vertex * g_ + block);
+    if (carry != carry_.end()) high = carry->second;
+  }
+  return high * std::numeric_limits<std::uint16_t>::max() + *low;
+}
+unsigned int marginal_accumulator_t::get_num_samples() const {return num_samples_;}
+unsigned int marginal_accumulator_t::get_support() const
+{
+  unsigned int support = 0;
+  for (unsigned int i = 0; i < N_; ++i)
+  {
+    for (unsigned int r = 0; r < g_; ++r)
+    {
+      const std::uint16_t * low = find(i, r);
+      if (low != nullptr && *low != 0) ++support;
+    }
+  }
+  return support;
+}
+uint_vec_t marginal_accumulator_t::get_permutation() const {return permutation_;}
+uint_vec_t marginal_accumulator_t::argmax() const
+{
+  uint_vec_t memberships(N_, 0);
+  for (unsigned int i = 0; i < N_; ++i)
+  {
+    unsigned int max = 0;
+    for (unsigned int r = 0; r < g_; ++r)
+    {
+      unsigned int c = count(i, r);
+      if (c > max)
+      {
+        memberships[i] = r;
+        max = c;
+      }
+    }
+  }
+  return memberships;
+}
+uint_mat_t marginal_accumulator_t::get_counts() const
+{
+  uint_mat_t counts(N_, uint_vec_t(g_, 0));
+  for (unsigned int i = 0; i < N_; ++i)
+  {
+    for (unsigned int r = 0; r < g_; ++r) counts[i][r] = count(i, r);
+  }
+  return counts;
+}
+unsigned int marginal_accumulator_t::get_N() const {return N_;}
+unsigned int marginal_accumulator_t::get_g() const {return g_;}
@@ -0,0 +1,86 @@
+#ifndef MARGINAL_H
+#define MARGINAL_H
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <unordered_map>
+#include "types.h"
+
+/* Assignment maximizing the total weight of a square matrix (Hungarian algorithm, O(g^3)).
+   Returns the column assigned to every row. If potentials is not nullptr, it receives column
+   potentials b such that sum_s max_r (w_sr - b_r) + sum_r b_r is the maximum weight. */
+uint_vec_t maximum_weight_matching(const uint_mat_t & weights, std::vector<long long> * potentials = nullptr);
+
+/* Marginal distribution of the block memberships, accumulated online.
+
+   Samples are aligned to the labelling of the first sample before they are counted,
+   so that permutations of the block labels by the chain do not mix up the marginals.
+   Only the permutations that leave p (and the block sizes, if given) invariant are used,
+   since the others map a state to a different state. The alignment matches the blocks
+   on the overlap matrix between the sample and the reference, which is updated
+   incrementally from the vertices that changed since the previous sample. The match is
+   only recomputed when the previous one can no longer be shown to be optimal.
+
+   The 16 bits counters live in one flat pool. For small g, every vertex has a dense row
+   of g counters. For larger g, every vertex keeps the first few blocks it visits in place,
+   and moves to a dense row at the end of the pool when it visits more. A counter wraps
+   from 65535 back to 1 and carries into a sparse overflow table, so that 0 always means
+   that the block was never visited. Block labels are stored on 16 bits: g is at most 65536. */
+class marginal_accumulator_t {
+public:
+  /* sizes are the fixed block sizes of the vertices swaps, empty for single vertex changes. */
+  marginal_accumulator_t(unsigned int N, const float_mat_t & p, const uint_vec_t & sizes=uint_vec_t());
+
+  void add(const uint_vec_t & memberships);
+  /* Reset the counts. The reference labelling is kept. */
+  void clear();
+
+  unsigned int count(unsigned int vertex, unsigned int block) const;
+  unsigned int get_num_samples() const;
+  /* Number of (vertex, block) counters in use. */
+  unsigned int get_support() const;
+  /* Permutation applied to the block labels of the last sample. */
+  uint_vec_t get_permutation() const;
+  uint_vec_t argmax() const;
+  uint_mat_t get_counts() const;
+  unsigned int get_N() const;
+  unsigned int get_g() const;
+
+private:
+  typedef struct entry_t
+  {
+    std::uint16_t block;
+    std::uint16_t count;
+  } entry_t;
+  typedef std::vector<std::uint16_t> label_vec_t;
+  static const unsigned int inline_entries = 4;
+    /// Counters
+  unsigned int N_;
+  unsigned int g_;
+  bool dense_;
+  std::vector<std::uint16_t> counts_;  // dense rows, at i * g for small g, or spilled rows
+  std::vector<entry_t> entries_;  // inline_entries blocks in place per vertex, for large g
+  std::unordered_map<unsigned int, std::size_t> spilled_;  // offset of the dense row of a vertex in counts_
+  std::unordered_map<unsigned long long, unsigned int> carry_;
+  unsigned int num_samples_;
+  std::uint16_t & counter(unsigned int vertex, unsigned int block);
+  void overflow(unsigned int vertex, unsigned int block, std::uint16_t & low);
+  const std::uint16_t * find(unsigned int vertex, unsigned int block) const;
+    /// Label alignment
+  float_mat_t p_;
+  uint_vec_t sizes_;
+  uint_vec_t classes_;  // blocks of different classes are never exchanged
+  label_vec_t reference_;
+  label_vec_t previous_;
+  uint_mat_t overlap_;  // overlap_[s][r]: vertices in block s of the sample and block r of the reference
+  uint_vec_t permutation_;
+  std::vector<long long> potentials_;  // column potentials of the last match
+  bool is_symmetry(const uint_vec_t & permutation) const;
+  unsigned int weight(unsigned int s, unsigned int r) const;
+  bool is_still_optimal() const;
+};
+
+#endif // MARGINAL_H
@@ -1,7 +1,8 @@
 /* ~~~~~~~~~~~~~~~~ Notes ~~~~~~~~~~~~~~~~ */
 // A few base assumption go into this program:
 // 
-// - We assume that node identifiers are zero indexed contiguous integers.
+// - Node identifiers are zero indexed contiguous integers, unless some are larger than the number of
+//   vertices; they are then relabelled in increasing order, and the order is logged as vertex_ids.
 // - We assume that block memberships are zero indexed contiguous integers.
 // - We assume that the SBM is of the undirected and simple variant.
 
@@ -10,16 +11,13 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
-#include <utility>
-#include <random>
 #include <string>
 // Boost
 #include <boost/program_options.hpp>
 // Program headers
 #include "types.h"
-#include "blockmodel.h"
+#include "inference.h"
 #include "output_functions.h"
-#include "metropolis_hasting.h"
 #include "graph_utilities.h"
 #include "config.h"
 
@@ -38,9 +36,24 @@ int main(int argc, char const *argv[]) {
     bool use_ppm = false;
     bool use_single_vertex = false;
     bool maximize = false;
+    bool adaptive = false;
+    bool score_cache = false;
+    unsigned int multiple_tries;
+    unsigned int sequential_degree;
+    double sequential_tolerance;
+    unsigned int target_ess;
+    double r_hat_threshold;
+    double stability_threshold;
     std::string cooling_schedule;
     float_vec_t cooling_schedule_kwargs(2,0);
+    unsigned int patience;
+    unsigned int restarts;
+    double perturbation;
     unsigned int seed = 0;
+    std::string rng;
+    std::string reorder;
+    std::string stats_file;
+    double stats_every;
 
     po::options_description description("Options");
     description.add_options()
@@ -64,8 +77,31 @@ int main(int argc, char const *argv[]) {
         "Use single vertex proposal distribution (defaults to vertices swap).")
     ("maximize,m",
         "Maximize likelihood instead of marginalizing.")
+    ("score_cache",
+        "Cache the move scores of the vertices, recomputed only when a neighbour moves. "\
+        "Requires probabilities strictly between 0 and 1. "\
+        "In maximize mode, single vertex proposals also favour the vertices whose neighbourhood changed.")
+    ("multiple_tries", po::value<unsigned int>(&multiple_tries)->default_value(1),
+        "Number of candidate moves of every step. Above 1, multiple-try Metropolis steps are used "\
+        "(requires probabilities strictly between 0 and 1).")
+    ("sequential_degree", po::value<unsigned int>(&sequential_degree)->default_value(0),
+        "Decide the single vertex moves of the vertices of at least this degree with a sequential test, "\
+        "stopped as soon as a bound on the remaining terms decides (0 disables it). "\
+        "Requires probabilities strictly between 0 and 1.")
+    ("sequential_tolerance", po::value<double>(&sequential_tolerance)->default_value(0),
+        "Sequential test: decide early when the acceptance probability is known within this tolerance "\
+        "(approximate decisions). 0 keeps the test exact.")
+    ("adaptive",
+        "Adaptive marginalization: burn-in, sampling frequency and number of samples are set from convergence diagnostics. "\
+        "burn_in becomes the minimal burn-in and sampling_steps the maximal total number of steps.")
+    ("target_ess", po::value<unsigned int>(&target_ess)->default_value(200),
+        "Target effective sample size of the adaptive marginalization.")
+    ("r_hat", po::value<double>(&r_hat_threshold)->default_value(1.05),
+        "Split R-hat threshold for the end of the adaptive burn-in.")
+    ("stability", po::value<double>(&stability_threshold)->default_value(0.05),
+        "Maximal fraction of vertices whose most likely block may lose frequency (beyond the sampling noise) between two burn-in windows in adaptive mode.")
     ("cooling_schedule,c", po::value<std::string>(&cooling_schedule)->default_value("exponential"),
-        "Cooling schedule for the simulated annealing algorithm. Options are exponential, linear, logarithmic and constant.")
+        "Cooling schedule for the simulated annealing algorithm. Options are exponential, linear, logarithmic, constant and adaptive.")
     ("cooling_schedule_kwargs,a", po::value<float_vec_t>(&cooling_schedule_kwargs)->multitoken(),
         "Additional arguments for the cooling schedule provided as a list of floats. "\
         "Depends on the choice of schedule:\n"\
@@ -75,9 +111,28 @@ int main(int argc, char const *argv[]) {
          "        eta (rate of decline).\n"\
          "Logarithmic: c (rate of decline)\n"\
          "             d (delay > 1)\n"\
-         "Constant: T (temperature > 0)")
+         "Constant: T (temperature > 0)\n"\
+         "Adaptive: T_0 (init. temperature > 0)\n"\
+         "          alpha (decay of the target acceptance rate per sweep, in ]0,1[).")
+    ("patience", po::value<unsigned int>(&patience)->default_value(20),
+        "Adaptive schedule: number of sweeps without improvement of the likelihood before stopping.")
+    ("restarts", po::value<unsigned int>(&restarts)->default_value(0),
+        "Adaptive schedule: number of annealing runs restarted in parallel from the best state.")
+    ("perturbation", po::value<double>(&perturbation)->default_value(0.1),
+        "Adaptive schedule: fraction of the vertices swapped in the best state before a restart.")
     ("seed,d", po::value<unsigned int>(&seed),
-        "Seed of the pseudo random number generator (Mersenne-twister 19937). A random seed is used if seed is not specified.")
+        "Seed of the pseudo random number generator. A random seed is used if seed is not specified.")
+    ("reorder", po::value<std::string>(&reorder)->default_value("none"),
+        "Reorder the vertices internally to improve memory locality. Options are none, bfs, rcm (reverse Cuthill-McKee) "\
+        "and degree. The output is in the original order.")
+    ("rng", po::value<std::string>(&rng)->default_value("xoshiro256"),
+        "Pseudo random number generator. Options are xoshiro256 and mt19937 (reproduces the runs of earlier versions).")
+    ("stats_file", po::value<std::string>(&stats_file),
+        "Append snapshots of the running sampler to this file, one JSON line each (step, phase, temperature, "\
+        "steps per second, acceptance rate, log-likelihood and resident memory). "\
+        "A snapshot is written on SIGUSR1, and every stats_every seconds.")
+    ("stats_every", po::value<double>(&stats_every)->default_value(0),
+        "Seconds between two snapshots written to stats_file (0: only on SIGUSR1).")
     ("help,h", "Produce this help message.")
     ;
     po::variables_map var_map;
@@ -111,187 +166,89 @@ int main(int argc, char const *argv[]) {
     if (var_map.count("use_single_vertex") > 0) {
         use_single_vertex = true;
     }
+    if (var_map.count("adaptive") > 0) {
+        adaptive = true;
+    }
     if (var_map.count("maximize") > 0) {
         maximize = true;
-        if (var_map.count("cooling_schedule_kwargs") == 0)
-        {
-          // defaults
-          if (cooling_schedule == "exponential")
-          {
-            cooling_schedule_kwargs[0] = 1;
-            cooling_schedule_kwargs[1] = 0.99;
-          } 
-          if (cooling_schedule == "linear")
-          {
-            cooling_schedule_kwargs[0] = sampling_steps + 1;
-            cooling_schedule_kwargs[1] = 1;
-          }
-          if (cooling_schedule == "logarithmic")
-          {
-            cooling_schedule_kwargs[0] = 1;
-            cooling_schedule_kwargs[1] = 1;
-          }
-          if (cooling_schedule == "constant")
-          {
-            cooling_schedule_kwargs[0] = 1;
-          }
-        }
-        else
-        {
-          // kwards not defaulted, must check.
-          if (cooling_schedule == "exponential")
-          {
-            if (cooling_schedule_kwargs[0] <= 0)
-            {
-              std::cerr << "Invalid cooling schedule argument for linear schedule: T_0 must be grater than 0.\n";
-              std::cerr << "Passed value: T_0=" << cooling_schedule_kwargs[0] << "\n";
-              return 1;
-            }
-            if (cooling_schedule_kwargs[1] <= 0 || cooling_schedule_kwargs[1] >= 1)
-            {
-              std::cerr << "Invalid cooling schedule argument for exponential schedule: alpha must be in ]0,1[.\n";
-              std::cerr << "Passed value: alpha=" << cooling_schedule_kwargs[1] << "\n";
-              return 1;
-            }
-          }
-          else if (cooling_schedule == "linear")
-          {
-            if (cooling_schedule_kwargs[0] <= 0)
-            {
-              std::cerr << "Invalid cooling schedule argument for linear schedule: T_0 must be grater than 0.\n";
-              std::cerr << "Passed value: T_0=" << cooling_schedule_kwargs[0] << "\n";
-              return 1;
-            }
-            if (cooling_schedule_kwargs[1] <= 0 || cooling_schedule_kwargs[1] > cooling_schedule_kwargs[0])
-            {
-              std::cerr << "Invalid cooling schedule argument for linear schedule: eta must be in ]0, T_0].\n";
-              std::cerr << "Passed value: T_0=" << cooling_schedule_kwargs[0]
-                        << ", eta=" << cooling_schedule_kwargs[1] << "\n";
-              return 1;
-            }
-            if (cooling_schedule_kwargs[1] * sampling_steps > cooling_schedule_kwargs[0])
-            {
-              std::cerr << "Invalid cooling schedule argument for linear schedule: eta * sampling_steps must be smaller or equal to T_0.\n";
-              std::cerr << "Passed value: eta*sampling_steps=" << cooling_schedule_kwargs[1] * sampling_steps
-                        << ", T_0=" << cooling_schedule_kwargs[0] << "\n";
-              return 1;
-            }
-          }
-          else if (cooling_schedule == "logarithmic")
-          {
-            if (cooling_schedule_kwargs[0] <= 0)
-            {
-              std::cerr << "Invalid cooling schedule argument for logarithmic schedule: c must be greater than 0.\n";
-              std::cerr << "Passed value: c=" << cooling_schedule_kwargs[0] << "\n";
-              return 1;
-            }
-            if (cooling_schedule_kwargs[1] <= 0)
-            {
-              std::cerr << "Invalid cooling schedule argument for logarithmic schedule: d must be greater than 0.\n";
-              std::cerr << "Passed value: d=" << cooling_schedule_kwargs[1] << "\n";
-              return 1;
-            }
-          }
-          else if (cooling_schedule == "constant")
-          {
-            if (cooling_schedule_kwargs[0] <= 0)
-            {
-              std::cerr << "Invalid cooling schedule argument for constant schedule: temperature must be greater than 0.\n";
-              std::cerr << "Passed value: T=" << cooling_schedule_kwargs[0] << "\n";
-              return 1;
-            }
-          }
-          else
-          {
-            std::cerr << "Invalid cooling schedule. Options are exponential, linear, logarithmic.\n";
-            return 1;
-          }
-        }
+    }
+    if (var_map.count("score_cache") > 0) {
+        score_cache = true;
     }
     if (var_map.count("seed") == 0) {
         // seeding based on the clock
         seed = (unsigned int) std::chrono::high_resolution_clock::now().time_since_epoch().count();
     }
-    /* ~~~~~ Setup objects ~~~~~~~*/
-    std::mt19937 engine(seed);
-    // number of blocks
     unsigned int g = n.size();
-    // number of vertices
-    unsigned int N = 0;
-    for (unsigned int i = 0; i < g; ++i) {
-      N += n[i];
+    if (probabilities.size() < (use_ppm ? 2 : g * g)) {
+        std::cerr << "Expected at least " << (use_ppm ? 2 : g * g) << " probabilities (-P flag), got " << probabilities.size() << ".\n";
+        return 1;
     }
-    // Graph structure
-    edge_list_t edge_list;
-    load_edge_list(edge_list, edge_list_path);
-    adj_list_t adj_list = edge_to_adj(edge_list, N);
-    edge_list.clear();
-    // memberships from block sizes
-    uint_vec_t memberships_init;
+    /* ~~~~~ Setup inference ~~~~~~~*/
+    inference_parameters_t parameters;
+    parameters.p = probability_matrix(probabilities, g, use_ppm);
+    parameters.n = n;
+    parameters.use_ppm = use_ppm;
+    parameters.use_single_vertex = use_single_vertex;
+    parameters.randomize = randomize;
+    parameters.maximize = maximize;
+    parameters.score_cache = score_cache;
+    parameters.multiple_tries = multiple_tries;
+    parameters.sequential_degree = sequential_degree;
+    parameters.sequential_tolerance = sequential_tolerance;
+    parameters.burn_in = burn_in;
+    parameters.sampling_steps = sampling_steps;
+    parameters.sampling_frequency = sampling_frequency;
+    parameters.adaptive = adaptive;
+    parameters.target_ess = target_ess;
+    parameters.r_hat_threshold = r_hat_threshold;
+    parameters.stability_threshold = stability_threshold;
+    parameters.cooling_schedule = cooling_schedule;
+    if (maximize && var_map.count("cooling_schedule_kwargs") == 0)
     {
-      unsigned int accu = 0;
-      for (auto it = n.begin(); it != n.end(); ++it) {
-          accu += *it;
-      }
-      memberships_init.resize(accu, 0);
-      unsigned shift = 0;
-      for (unsigned int r = 0; r < n.size(); ++r) {
-          for (unsigned int i = 0; i < n[r]; ++i) {
-              memberships_init[shift + i] = r;
-          }
-          shift += n[r];
-      }
+      cooling_schedule_kwargs = default_cooling_schedule_kwargs(cooling_schedule, sampling_steps);
     }
-    // blockmodel
-    blockmodel_t blockmodel(memberships_init, g, adj_list.size(), &adj_list);
-    memberships_init.clear();
-    if (randomize) {
-        blockmodel.shuffle(engine);
+    parameters.cooling_schedule_kwargs = cooling_schedule_kwargs;
+    parameters.patience = patience;
+    parameters.restarts = restarts;
+    parameters.perturbation = perturbation;
+    parameters.seed = seed;
+    parameters.rng = rng;
+    parameters.reorder = reorder;
+    #if OUTPUT_HISTORY == 1 // compile time output
+    parameters.history = [](const uint_vec_t & memberships) {output_vec<uint_vec_t>(memberships, std::cout);};
+    #endif
+    std::string error;
+    if (!check_parameters(parameters, error)) {
+        std::cerr << error;
+        return 1;
     }
-    // probabilities
-    float_mat_t p(g, float_vec_t(g, 0));
-    if (!use_ppm)
-    {
-      for (unsigned int r = 0; r < g; ++r)
-      {
-        for (unsigned int s = 0; s < g; ++s)
-        {
-          p[r][s] = probabilities[s + r*g];
-        }
-      }
+    // Graph structure
+    edge_list_t edge_list;
+    if (!load_edge_list(edge_list, edge_list_path)) {
+        std::cerr << "Could not open edge list " << edge_list_path << ".\n";
+        return 1;
     }
-    else
-    {
-      for (unsigned int r = 0; r < g; ++r)
-      {
-        p[r][r] = probabilities[0];
-        for (unsigned int s = r + 1; s < g; ++s)
-        {
-          p[r][s] = probabilities[1];
-          p[s][r] = probabilities[1];
+    // Telemetry
+    telemetry_t telemetry;
+    if (var_map.count("stats_file") > 0) {
+        if (!telemetry.start(stats_file, stats_every, error)) {
+            std::cerr << error;
+            return 1;
         }
-      }
-    }
-    // Bind proper Metropolis-Hasting algorithm
-    std::shared_ptr<metropolis_hasting> algorithm;
-    if (!use_ppm && use_single_vertex) {
-        algorithm = std::make_shared<mh_single_vertex_sbm>();
+        telemetry.handle_signal();
+        parameters.telemetry = &telemetry;
     }
-    else if (use_ppm && use_single_vertex) {
-        algorithm = std::make_shared<mh_single_vertex_ppm>();    
-    }
-    else if (!use_ppm &&  !use_single_vertex) {
-        algorithm = std::make_shared<mh_vertices_swap_sbm>();     
-    }
-    else if (use_ppm && !use_single_vertex) {
-        algorithm = std::make_shared<mh_vertices_swap_ppm>();     
+    else if (stats_every > 0) {
+        std::cerr << "stats_every requires stats_file.\n";
+        return 1;
     }
 
     /* ~~~~~ Logging ~~~~~~~*/
     #if LOGGING == 1
     std::clog << "edge_list_path: " << edge_list_path << "\n";
     std::clog << "probabilities:\n";
-    output_mat<float_mat_t>(p, std::clog);
+    output_mat<float_mat_t>(parameters.p, std::clog);
     std::clog << "sizes (g=" << n.size() << "): ";
     for (auto it = n.begin(); it != n.end(); ++it)
         std::clog << *it << " ";
@@ -299,6 +256,13 @@ int main(int argc, char const *argv[]) {
     std::clog << "burn_in: " << burn_in << "\n";
     std::clog << "sampling_steps: " << sampling_steps << "\n";
     std::clog << "sampling_frequency: " << sampling_frequency << "\n";
+    if (adaptive && !maximize)
+    {
+      std::clog << "adaptive: true\n";
+      std::clog << "target_ess: " << target_ess << "\n";
+      std::clog << "r_hat: " << r_hat_threshold << "\n";
+      std::clog << "stability: " << stability_threshold << "\n";
+    }
     if (maximize) {std::clog << "maximize: true\n";}
     else {std::clog << "maximize: false\n";}
     if (use_ppm) {std::clog << "use_ppm: true\n";}
@@ -307,56 +271,78 @@ int main(int argc, char const *argv[]) {
     else {std::clog << "use_single_vertex: false\n";}
     if (randomize) {std::clog << "randomize: true\n";}
     else {std::clog << "randomize: false\n";}
+    if (score_cache) {std::clog << "score_cache: true\n";}
+    else {std::clog << "score_cache: false\n";}
+    std::clog << "multiple_tries: " << multiple_tries << "\n";
+    if (sequential_degree > 0)
+    {
+      std::clog << "sequential_degree: " << sequential_degree << "\n";
+      std::clog << "sequential_tolerance: " << sequential_tolerance << "\n";
+    }
     if (maximize)
     {
       std::clog << "cooling_schedule: " << cooling_schedule << "\n";
       std::clog << "cooling_schedule_kwargs: ";
       output_vec<float_vec_t>(cooling_schedule_kwargs);
+      if (cooling_schedule == "adaptive")
+      {
+        std::clog << "patience: " << patience << "\n";
+        std::clog << "restarts: " << restarts << "\n";
+        std::clog << "perturbation: " << perturbation << "\n";
+      }
     }
     std::clog << "seed: " << seed << "\n";
+    std::clog << "rng: " << rng << "\n";
+    std::clog << "reorder: " << reorder << "\n";
+    if (parameters.telemetry != nullptr)
+    {
+      std::clog << "stats_file: " << stats_file << "\n";
+      std::clog << "stats_every: " << stats_every << "\n";
+    }
     #endif
 
     /* ~~~~~ Actual algorithm ~~~~~~~*/
-    double rate = 0;
-    uint_mat_t marginal(adj_list.size(), uint_vec_t(g, 0));
+    inference_result_t result;
+    if (!infer(edge_list, parameters, result, error)) {
+        std::cerr << error;
+        return 1;
+    }
+    #if LOGGING == 1
+    for (unsigned int i = 0; i < result.vertex_ids.size(); ++i) {
+        if (result.vertex_ids[i] != i) {
+            std::clog << "vertex_ids: ";
+            output_vec<uint_vec_t>(result.vertex_ids, std::clog);
+            break;
+        }
+    }
+    #endif
+    output_vec<uint_vec_t>(result.memberships, std::cout);
+    if (sequential_degree > 0)
+    {
+      std::clog << "sequential early_decisions " << result.early_decisions << "\n";
+      std::clog << "sequential approximate_decisions " << result.approximate_decisions << "\n";
+    }
     if (maximize)
     {
-      if (cooling_schedule == "exponential")
-      {
-        algorithm->anneal(blockmodel, p, &exponential_schedule, cooling_schedule_kwargs, sampling_steps, engine);
-      }
-      if (cooling_schedule == "linear")
-      {
-        algorithm->anneal(blockmodel, p, &linear_schedule, cooling_schedule_kwargs, sampling_steps, engine);
-      }
-      if (cooling_schedule == "logarithmic")
-      {
-        algorithm->anneal(blockmodel, p, &logarithmic_schedule, cooling_schedule_kwargs, sampling_steps, engine);
-      }
-      if (cooling_schedule == "constant")
-      {
-        algorithm->anneal(blockmodel, p, &constant_schedule, cooling_schedule_kwargs, sampling_steps, engine);
-      }
-      output_vec<uint_vec_t>(blockmodel.get_memberships(), std::cout);
+      std::clog << "log_likelihood " << result.log_likelihood << "\n";
     }
-    else  // marginalize
-    {  
-      rate = algorithm->marginalize(blockmodel, marginal, p, burn_in, sampling_frequency, sampling_steps, engine);
-      uint_vec_t memberships(blockmodel.get_N(), 0);
-      for (unsigned int i = 0; i < blockmodel.get_N(); ++i)
+    else
+    {
+      std::clog << "acceptance ratio " <<  result.acceptance_ratio  <<  "\n";
+      if (adaptive)
       {
-        unsigned int max = 0;
-        for (unsigned int r = 0; r < g; ++r)
+        const convergence_t & convergence = result.convergence;
+        if (!convergence.converged)
         {
-          if (marginal[i][r] > max)
-          {
-            memberships[i] = r;
-            max = marginal[i][r];
-          }
+          std::clog << "warning: step budget exhausted before convergence\n";
         }
+        std::clog << "adaptive burn_in " << convergence.burn_in << "\n";
+        std::clog << "adaptive sampling_frequency " << convergence.sampling_frequency << "\n";
+        std::clog << "adaptive num_samples " << convergence.num_samples << "\n";
+        std::clog << "autocorrelation_time " << convergence.autocorrelation_time << "\n";
+        std::clog << "r_hat " << convergence.r_hat << "\n";
+        std::clog << "effective_sample_size " << convergence.effective_sample_size << "\n";
       }
-      output_vec<uint_vec_t>(memberships, std::cout);
-      std::clog << "acceptance ratio " <<  rate  <<  "\n";
     }
     return 0;
 }
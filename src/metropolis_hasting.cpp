@@ -5,74 +5,396 @@
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // Implemented from
 // http://www.fys.ku.dk/~andresen/BAhome/ownpapers/permanents/annealSched.pdf
-double exponential_schedule(unsigned int t, float_vec_t cooling_schedule_kwargs)
+double exponential_schedule(unsigned int t, const float_vec_t & cooling_schedule_kwargs)
 {
   // kwargs is the speed of the exponential cooling.
   return cooling_schedule_kwargs[0] * std::pow(cooling_schedule_kwargs[1], t);
 }
-double linear_schedule(unsigned int t, float_vec_t cooling_schedule_kwargs)
+double linear_schedule(unsigned int t, const float_vec_t & cooling_schedule_kwargs)
 {
   // kwargs are the initial temperature and a rate of linear cooling.
   return cooling_schedule_kwargs[0] - cooling_schedule_kwargs[1] * t;
 }
-double logarithmic_schedule(unsigned int t, float_vec_t cooling_schedule_kwargs)
+double logarithmic_schedule(unsigned int t, const float_vec_t & cooling_schedule_kwargs)
 {
   // kwargs are the rate of lienar cooling and a delay (typically 1).
   return cooling_schedule_kwargs[0] / std::log(t + cooling_schedule_kwargs[1]);
 }
-double constant_schedule(unsigned int t, float_vec_t cooling_schedule_kwargs)
+double constant_schedule(unsigned int t, const float_vec_t & cooling_schedule_kwargs)
 {
   // kwargs are the rate of lienar cooling and a delay (typically 1).
   return cooling_schedule_kwargs[0];
 }
 
+cooling_schedule_t get_cooling_schedule(const std::string & name)
+{
+  if (name == "exponential") return &exponential_schedule;
+  if (name == "linear") return &linear_schedule;
+  if (name == "logarithmic") return &logarithmic_schedule;
+  if (name == "constant") return &constant_schedule;
+  return nullptr;
+}
+
+double log_likelihood(const blockmodel_t& blockmodel, const float_mat_t& p)
+{
+  uint_mat_t m = blockmodel.get_m();
+  int_vec_t n = blockmodel.get_size_vector();
+  double ll = 0;
+  for (unsigned int r = 0; r < n.size(); ++r)
+  {
+    for (unsigned int s = r; s < n.size(); ++s)
+    {
+      double pairs = (r == s) ? n[r] * (n[r] - 1) / 2. : (double) n[r] * n[s];
+      // Skip empty terms, so that p = 0 or 1 do not produce 0 * log(0).
+      if (m[r][s] > 0) ll += m[r][s] * std::log((double) p[r][s]);
+      if (pairs > m[r][s]) ll += (pairs - m[r][s]) * std::log(1 - (double) p[r][s]);
+    }
+  }
+  return ll;
+}
+
 
 
+/* Moves that leave every vertex in its block. */
+static bool is_null_move(const std::vector<mcmc_move_t> & moves)
+{
+  for (auto move = moves.begin(); move != moves.end(); ++move)
+  {
+    if (move->source != move->target) return false;
+  }
+  return true;
+}
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // metropolis_hasting class
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 bool metropolis_hasting::step(blockmodel_t& blockmodel,
                               const float_mat_t& p,
                               double temperature,
-                              std::mt19937 & engine)
+                              rng_t& engine)
 {
+  if (telemetry_ != nullptr && telemetry_->get_generation() != generation_)
+  {
+    report(blockmodel, p, temperature);
+  }
+  ++steps_;
+  log_likelihood_change_ = 0;
+  null_move_ = false;
+  if (propose_and_accept(blockmodel, p, temperature, engine))
+  {
+    ++accepted_steps_;
+    return true;
+  }
+  return false;
+}
+bool metropolis_hasting::propose_and_accept(blockmodel_t& blockmodel,
+                                            const float_mat_t& p,
+                                            double temperature,
+                                            rng_t& engine)
+{
+  if (tries_ > 1) return step_multiple_try(blockmodel, p, temperature, tries_, engine);
   std::vector<mcmc_move_t> moves = sample_proposal_distribution(blockmodel, engine);
-  double a = std::pow(transition_ratio(blockmodel, p, moves), 1 / temperature);
-  if (random_real(engine) < a || a > 1)
+  null_move_ = is_null_move(moves);
+  if (sequential_degree_ > 0 && moves.size() == 1 &&
+      blockmodel.get_adj_list_ptr()->at(moves[0].vertex).size() >= sequential_degree_)
+  {
+    if (!sequential_test(blockmodel, p, moves[0], temperature, engine)) return false;
+    if (track_log_likelihood_) log_transition_ratios(blockmodel, p, moves, 1, &log_likelihood_change_);
+    blockmodel.apply_mcmc_moves(moves);
+    return true;
+  }
+  double ratio = transition_ratio(blockmodel, p, moves);
+  double a = std::pow(ratio, 1 / temperature);
+  if (engine.uniform_real() < a || a > 1)
   {
+    if (track_log_likelihood_) log_likelihood_change_ = std::log(ratio);
     blockmodel.apply_mcmc_moves(moves);
     return true;
   }
   return false;
 }
+bool metropolis_hasting::sequential_test(const blockmodel_t& blockmodel,
+                                         const float_mat_t& p,
+                                         const mcmc_move_t & move,
+                                         double temperature,
+                                         rng_t& engine)
+{
+  // Accept iff log ratio > T log u.
+  const double threshold = temperature * std::log(engine.uniform_real());
+  const unsigned int r = move.source;
+  const unsigned int s = move.target;
+  if (r == s) return true;
+  const unsigned int g = blockmodel.get_g();
+  if (log_p_.update(p) || bounds_p_ != &p || bound_w_.size() != g * g)
+  {
+    bounds_p_ = &p;
+    bound_w_.assign(g * g, 0);
+    bound_q_.assign(g * g, 0);
+    for (unsigned int a = 0; a < g; ++a)
+    {
+      for (unsigned int b = 0; b < g; ++b)
+      {
+        for (unsigned int l = 0; l < g; ++l)
+        {
+          bound_w_[a * g + b] = std::max(bound_w_[a * g + b], std::fabs(log_p_.w(b)[l] - log_p_.w(a)[l]));
+          bound_q_[a * g + b] = std::max(bound_q_[a * g + b], std::fabs(log_p_.q(b)[l] - log_p_.q(a)[l]));
+        }
+      }
+    }
+  }
+  const int * k = blockmodel.get_k_data(move.vertex);
+  const int * n = blockmodel.get_size_data();
+  const double * wr = log_p_.w(r);
+  const double * ws = log_p_.w(s);
+  const double * qr = log_p_.q(r);
+  const double * qs = log_p_.q(s);
+  // Terms of blocks r and s (the vertex itself is excluded from n_r).
+  double x = k[r] * (ws[r] - wr[r]) + (n[r] - 1) * (qs[r] - qr[r]) +
+             k[s] * (ws[s] - wr[s]) + n[s] * (qs[s] - qr[s]);
+  // The other blocks hold the rest of the neighbours and of the vertices.
+  double degree_left = blockmodel.get_adj_list_ptr()->at(move.vertex).size() - k[r] - k[s];
+  double size_left = blockmodel.get_N() - n[r] - n[s];
+  const double dw = bound_w_[r * g + s];
+  const double dq = bound_q_[r * g + s];
+  double bound = degree_left * dw + size_left * dq;
+  if (x - bound > threshold || x + bound <= threshold)
+  {
+    ++early_decisions_;
+    return x - bound > threshold;
+  }
+  if (sequential_tolerance_ > 0)
+  {
+    // Width of the interval of acceptance probabilities.
+    double low = std::min(1., std::exp((x - bound) / temperature));
+    double high = std::min(1., std::exp((x + bound) / temperature));
+    if (high - low < sequential_tolerance_)
+    {
+      ++approximate_decisions_;
+      return x > threshold;
+    }
+  }
+  for (unsigned int l = 0; l < g; ++l)
+  {
+    if (l == r || l == s) continue;
+    x += k[l] * (ws[l] - wr[l]) + n[l] * (qs[l] - qr[l]);
+    degree_left -= k[l];
+    size_left -= n[l];
+    bound = degree_left * dw + size_left * dq;
+    if (x - bound > threshold || x + bound <= threshold)
+    {
+      if (degree_left > 0 || size_left > 0) ++early_decisions_;
+      return x - bound > threshold;
+    }
+  }
+  return x > threshold;
+}
+void metropolis_hasting::set_telemetry(telemetry_t * telemetry, unsigned int chain)
+{
+  telemetry_ = telemetry;
+  chain_ = chain;
+  if (telemetry_ != nullptr) generation_ = telemetry_->get_generation();
+  reported_steps_ = steps_;
+  reported_accepted_steps_ = accepted_steps_;
+  reported_time_ = std::chrono::steady_clock::now();
+}
+void metropolis_hasting::report(const blockmodel_t& blockmodel, const float_mat_t& p, double temperature)
+{
+  generation_ = telemetry_->get_generation();
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+  double elapsed = std::chrono::duration<double>(now - reported_time_).count();
+  unsigned long steps = steps_ - reported_steps_;
+  telemetry_snapshot_t snapshot;
+  snapshot.chain = chain_;
+  snapshot.step = steps_;
+  snapshot.phase = phase_;
+  snapshot.phase_step = steps_ - phase_begin_;
+  snapshot.phase_length = phase_length_;
+  snapshot.temperature = temperature;
+  snapshot.steps_per_second = (elapsed > 0) ? steps / elapsed : 0;
+  snapshot.acceptance_rate = (steps > 0) ? (double) (accepted_steps_ - reported_accepted_steps_) / steps : 0;
+  snapshot.log_likelihood = log_likelihood(blockmodel, p);
+  telemetry_->publish(snapshot);
+  reported_steps_ = steps_;
+  reported_accepted_steps_ = accepted_steps_;
+  reported_time_ = now;
+}
+/* log(sum_i exp(x_i)), without overflow. */
+static double log_sum_exp(const double * x, unsigned int size)
+{
+  double m = *std::max_element(x, x + size);
+  if (std::isinf(m)) return m;
+  double sum = 0;
+  for (unsigned int i = 0; i < size; ++i)
+  {
+    sum += std::exp(x[i] - m);
+  }
+  return m + std::log(sum);
+}
+bool metropolis_hasting::step_multiple_try(blockmodel_t& blockmodel,
+                                           const float_mat_t& p,
+                                           double temperature,
+                                           unsigned int tries,
+                                           rng_t& engine)
+{
+  const double beta = 1 / temperature;
+  // Candidates y_j drawn from the current state x, weighted by pi(y_j)^beta (relative to pi(x)^beta).
+  candidates_.clear();
+  for (unsigned int j = 0; j < tries; ++j)
+  {
+    std::vector<mcmc_move_t> moves = sample_proposal_distribution(blockmodel, engine);
+    candidates_.insert(candidates_.end(), moves.begin(), moves.end());
+  }
+  const unsigned int stride = candidates_.size() / tries;
+  log_ratios_.resize(2 * tries);
+  double * forward = &log_ratios_[0];
+  double * backward = &log_ratios_[tries];
+  log_transition_ratios(blockmodel, p, candidates_, stride, forward);
+  const unsigned int best = std::max_element(forward, forward + tries) - forward;
+  const double best_log_ratio = forward[best];
+  bool greedy = std::isinf(beta);
+  for (unsigned int j = 0; j < tries; ++j)
+  {
+    forward[j] *= beta;
+    greedy = greedy || std::isinf(forward[j]);
+  }
+  if (greedy)
+  {
+    // Zero temperature limit (or weights out of range): move to the best candidate,
+    // unless it lowers the log-likelihood.
+    std::vector<mcmc_move_t> moves(candidates_.begin() + best * stride,
+                                   candidates_.begin() + (best + 1) * stride);
+    null_move_ = is_null_move(moves);
+    if (best_log_ratio < 0) return false;
+    if (track_log_likelihood_) log_likelihood_change_ = best_log_ratio;
+    blockmodel.apply_mcmc_moves(moves);
+    return true;
+  }
+  double log_forward = log_sum_exp(forward, tries);
+  // Select y proportionally to its weight, and move to y.
+  unsigned int selected = tries - 1;
+  double u = engine.uniform_real();
+  for (unsigned int j = 0; j < tries - 1; ++j)
+  {
+    u -= std::exp(forward[j] - log_forward);
+    if (u < 0)
+    {
+      selected = j;
+      break;
+    }
+  }
+  std::vector<mcmc_move_t> moves(candidates_.begin() + selected * stride,
+                                 candidates_.begin() + (selected + 1) * stride);
+  null_move_ = is_null_move(moves);
+  blockmodel.apply_mcmc_moves(moves);
+  // Reference points drawn from y, plus x itself, weighted relative to pi(x)^beta.
+  candidates_.clear();
+  for (unsigned int j = 0; j < tries - 1; ++j)
+  {
+    std::vector<mcmc_move_t> reference = sample_proposal_distribution(blockmodel, engine);
+    candidates_.insert(candidates_.end(), reference.begin(), reference.end());
+  }
+  log_transition_ratios(blockmodel, p, candidates_, stride, backward);
+  for (unsigned int j = 0; j < tries - 1; ++j)
+  {
+    backward[j] = forward[selected] + beta * backward[j];
+  }
+  backward[tries - 1] = 0;
+  double log_backward = log_sum_exp(backward, tries);
+  if (std::log(engine.uniform_real()) < log_forward - log_backward)
+  {
+    if (track_log_likelihood_) log_likelihood_change_ = forward[selected] / beta;
+    return true;
+  }
+  // Rejected: undo the moves in reverse order.
+  std::vector<mcmc_move_t> inverse(moves.rbegin(), moves.rend());
+  for (auto move = inverse.begin(); move != inverse.end(); ++move)
+  {
+    std::swap(move->source, move->target);
+  }
+  blockmodel.apply_mcmc_moves(inverse);
+  return false;
+}
+void metropolis_hasting::log_transition_ratios(const blockmodel_t& blockmodel, const float_mat_t& p,
+                                               const std::vector<mcmc_move_t> & moves, unsigned int stride,
+                                               double * log_ratios)
+{
+  log_p_.update(p);
+  const unsigned int g = blockmodel.get_g();
+  const unsigned int count = moves.size() / stride;
+  if (stride == 1)
+  {
+    // log ratio = sum_l k_l (w_sl - w_rl) + n_l (q_sl - q_rl) - q_sr + q_rr
+    const int * n = blockmodel.get_size_data();
+    for (unsigned int c = 0; c < count; ++c)
+    {
+      const unsigned int r = moves[c].source;
+      const unsigned int s = moves[c].target;
+      const int * k = blockmodel.get_k_data(moves[c].vertex);
+      const double * wr = log_p_.w(r);
+      const double * ws = log_p_.w(s);
+      const double * qr = log_p_.q(r);
+      const double * qs = log_p_.q(s);
+      double x = 0;
+      for (unsigned int l = 0; l < g; ++l)
+      {
+        x += k[l] * (ws[l] - wr[l]) + n[l] * (qs[l] - qr[l]);
+      }
+      log_ratios[c] = (r == s) ? 0 : x - qs[r] + qr[r];
+    }
+  }
+  else
+  {
+    // log ratio = sum_l (ki_l - kj_l) (w_sl - w_rl) + a_ij (2 w_rs - w_rr - w_ss)
+    for (unsigned int c = 0; c < count; ++c)
+    {
+      const unsigned int r = moves[2 * c].source;
+      const unsigned int s = moves[2 * c + 1].source;
+      if (r == s)
+      {
+        log_ratios[c] = 0;
+        continue;
+      }
+      const int * ki = blockmodel.get_k_data(moves[2 * c].vertex);
+      const int * kj = blockmodel.get_k_data(moves[2 * c + 1].vertex);
+      const double * wr = log_p_.w(r);
+      const double * ws = log_p_.w(s);
+      double x = 0;
+      for (unsigned int l = 0; l < g; ++l)
+      {
+        x += (ki[l] - kj[l]) * (ws[l] - wr[l]);
+      }
+      if (blockmodel.are_connected(moves[2 * c].vertex, moves[2 * c + 1].vertex))
+      {
+        x += 2 * wr[s] - wr[r] - ws[s];
+      }
+      log_ratios[c] = x;
+    }
+  }
+}
 double metropolis_hasting::marginalize(blockmodel_t& blockmodel,
-                                       uint_mat_t& marginal_distribution,
+                                       marginal_accumulator_t& marginal_distribution,
                                        const float_mat_t& p,
                                        unsigned int burn_in_time,
                                        unsigned int sampling_frequency,
                                        unsigned int num_samples,
-                                       std::mt19937& engine)
+                                       rng_t& engine)
 {
   unsigned int accetped_steps = 0;
   // Burn-in period
+  begin_phase("burn_in", burn_in_time);
   for (unsigned int t = 0; t < burn_in_time; ++t)
   {
     step(blockmodel, p, 1.0, engine);
   }
   // Sampling
+  begin_phase("sampling", (unsigned long) sampling_frequency * num_samples);
   for (unsigned int t = 0; t < sampling_frequency * num_samples; ++t)
   {
     if (t % sampling_frequency == 0)
     {
       // Sample the blockmodel
       uint_vec_t memberships = blockmodel.get_memberships();
-      #if OUTPUT_HISTORY == 1 // compile time output
-      output_vec<uint_vec_t>(memberships, std::cout);
-      #endif
-      for (unsigned int i = 0; i < blockmodel.get_N(); ++i)
-      {
-        marginal_distribution[i][memberships[i]] += 1;
-      }
+      if (history_) history_(memberships);
+      marginal_distribution.add(memberships);
     }
     if (step(blockmodel, p, 1.0, engine))
     {
@@ -81,35 +403,227 @@ double metropolis_hasting::marginalize(blockmodel_t& blockmodel,
   }
   return (double) accetped_steps / ((double) sampling_frequency * num_samples);
 }
+double metropolis_hasting::marginalize_adaptive(blockmodel_t& blockmodel,
+                                                marginal_accumulator_t& marginal_distribution,
+                                                const float_mat_t& p,
+                                                unsigned int min_burn_in,
+                                                unsigned int max_steps,
+                                                unsigned int target_ess,
+                                                double r_hat_threshold,
+                                                double stability_threshold,
+                                                convergence_t& convergence,
+                                                rng_t& engine)
+{
+  // Diagnostics are computed on a log-likelihood trace recorded every stride steps, starting with every step.
+  // The log-likelihood follows the log ratios of the accepted steps, and is recomputed once per sweep (N steps).
+  // When the trace is full, every second entry is dropped and the stride doubles.
+  const unsigned int sweep = blockmodel.get_N();
+  const unsigned int window = 10 * sweep;  // steps between two burn-in checks
+  const unsigned int max_trace = 1 << 16;
+  unsigned int stride = 1;
+  unsigned int t = 0;
+  convergence.converged = false;
+  convergence.r_hat = std::numeric_limits<double>::infinity();
+  // Burn-in: ends when the second half of the trace passes the split R-hat test and
+  // the marginals of two consecutive windows agree, up to the sampling noise.
+  trace_t trace;
+  marginal_accumulator_t window_marginal(marginal_distribution);  // with the same symmetries
+  window_marginal.clear();
+  uint_mat_t previous_counts;
+  unsigned int previous_samples = 0;
+  bool burnt_in = false;
+  track_log_likelihood_ = true;
+  double ll = log_likelihood(blockmodel, p);
+  begin_phase("burn_in", max_steps);
+  while (!burnt_in && t < max_steps)
+  {
+    step(blockmodel, p, 1.0, engine);
+    ++t;
+    ll += log_likelihood_change_;
+    if (t % sweep == 0)
+    {
+      ll = log_likelihood(blockmodel, p);
+      window_marginal.add(blockmodel.get_memberships());
+    }
+    if (t % stride == 0)
+    {
+      trace.push_back(ll);
+      if (trace.size() == max_trace)
+      {
+        for (unsigned int i = 0; i < max_trace / 2; ++i) trace[i] = trace[2 * i + 1];
+        trace.resize(max_trace / 2);
+        stride *= 2;
+      }
+    }
+    if (t % window == 0)
+    {
+      uint_mat_t counts = window_marginal.get_counts();
+      unsigned int samples = window_marginal.get_num_samples();
+      window_marginal.clear();
+      convergence.r_hat = split_r_hat(std::vector<trace_t>(1, trace_t(trace.begin() + trace.size() / 2, trace.end())));
+      if (t >= min_burn_in && previous_samples > 0 &&
+          convergence.r_hat < r_hat_threshold &&
+          marginal_change(previous_counts, previous_samples, counts, samples) <= stability_threshold)
+      {
+        burnt_in = true;
+      }
+      previous_counts = counts;
+      previous_samples = samples;
+    }
+  }
+  track_log_likelihood_ = false;
+  convergence.burn_in = t;
+  // Thinning: one sample per autocorrelation time of the post warm-up trace.
+  double tau = autocorrelation_time(trace_t(trace.begin() + trace.size() / 2, trace.end())) * stride;
+  convergence.autocorrelation_time = tau;
+  convergence.sampling_frequency = std::max(1u, (unsigned int) std::ceil(tau));
+  // Sampling: until the log-likelihood of the samples reaches the target effective sample size,
+  // checked every target_ess / 4 samples.
+  const unsigned int ess_check = std::max(1u, target_ess / 4);
+  unsigned int accepted_steps = 0;
+  unsigned int sampling_steps = 0;
+  trace_t samples;
+  convergence.effective_sample_size = 0;
+  begin_phase("sampling", max_steps - t);
+  while (burnt_in && t < max_steps)
+  {
+    if (sampling_steps % convergence.sampling_frequency == 0)
+    {
+      uint_vec_t memberships = blockmodel.get_memberships();
+      if (history_) history_(memberships);
+      marginal_distribution.add(memberships);
+      samples.push_back(log_likelihood(blockmodel, p));
+      if (samples.size() >= target_ess && samples.size() % ess_check == 0)
+      {
+        convergence.effective_sample_size = effective_sample_size(samples);
+        if (convergence.effective_sample_size >= target_ess)
+        {
+          convergence.converged = true;
+          break;
+        }
+      }
+    }
+    if (step(blockmodel, p, 1.0, engine))
+    {
+      ++accepted_steps;
+    }
+    ++sampling_steps;
+    ++t;
+  }
+  convergence.num_samples = samples.size();
+  if (!convergence.converged && !samples.empty())
+  {
+    convergence.effective_sample_size = effective_sample_size(samples);
+  }
+  if (sampling_steps == 0) return 0;
+  return (double) accepted_steps / sampling_steps;
+}
 void metropolis_hasting::anneal(blockmodel_t& blockmodel,
                                   const float_mat_t& p,
-                                  double (*cooling_schedule)(unsigned int, float_vec_t),
-                                  float_vec_t cooling_schedule_kwargs,
+                                  cooling_schedule_t cooling_schedule,
+                                  const float_vec_t & cooling_schedule_kwargs,
                                   unsigned int duration,
-                                  std::mt19937& engine)
+                                  rng_t& engine)
 {
+  begin_phase("annealing", duration);
   for (unsigned int t = 0; t < duration; ++t)
   {
-    #if OUTPUT_HISTORY == 1  // compile time output
-    output_vec<uint_vec_t>(blockmodel.get_memberships(), std::cout);
-    #endif
+    if (history_) history_(blockmodel.get_memberships());
     step(blockmodel, p, cooling_schedule(t, cooling_schedule_kwargs), engine);
   }
 }
+double metropolis_hasting::anneal_adaptive(blockmodel_t& blockmodel,
+                                           const float_mat_t& p,
+                                           double initial_temperature,
+                                           double alpha,
+                                           unsigned int patience,
+                                           unsigned int duration,
+                                           rng_t& engine)
+{
+  const unsigned int sweep = blockmodel.get_N();
+  double temperature = initial_temperature;
+  const double min_temperature = initial_temperature * 1e-6;
+  double target = -1;  // set from the acceptance rate of the first sweep
+  uint_vec_t best_memberships = blockmodel.get_memberships();
+  double best_log_likelihood = log_likelihood(blockmodel, p);
+  unsigned int sweeps_without_improvement = 0;
+  unsigned int t = 0;
+  begin_phase("annealing", duration);
+  while (t < duration && sweeps_without_improvement < patience)
+  {
+    unsigned int accepted_steps = 0;
+    unsigned int proposals = 0;
+    for (unsigned int steps = 0; steps < sweep && t < duration; ++steps, ++t)
+    {
+      if (history_) history_(blockmodel.get_memberships());
+      bool accepted = step(blockmodel, p, temperature, engine);
+      if (null_move_) continue;
+      ++proposals;
+      if (accepted) ++accepted_steps;
+    }
+    if (proposals > 0)
+    {
+      double acceptance = (double) accepted_steps / proposals;
+      if (target < 0) target = acceptance;
+      target *= alpha;
+      temperature = std::max(temperature * std::exp(target - acceptance), min_temperature);
+    }
+    double ll = log_likelihood(blockmodel, p);
+    if (ll > best_log_likelihood)
+    {
+      best_log_likelihood = ll;
+      best_memberships = blockmodel.get_memberships();
+      sweeps_without_improvement = 0;
+    }
+    else
+    {
+      ++sweeps_without_improvement;
+    }
+  }
+  blockmodel.set_memberships(best_memberships);
+  return best_log_likelihood;
+}
 
 
+template<template<unsigned int> class fixed_t, class generic_t>
+static std::shared_ptr<metropolis_hasting> make_specialized(unsigned int g)
+{
+  switch (g)
+  {
+    case 2: return std::make_shared< fixed_t<2> >();
+    case 3: return std::make_shared< fixed_t<3> >();
+    case 4: return std::make_shared< fixed_t<4> >();
+    case 5: return std::make_shared< fixed_t<5> >();
+    case 6: return std::make_shared< fixed_t<6> >();
+    case 7: return std::make_shared< fixed_t<7> >();
+    case 8: return std::make_shared< fixed_t<8> >();
+    default: return std::make_shared<generic_t>();
+  }
+}
+
+std::shared_ptr<metropolis_hasting> make_algorithm(bool use_ppm, bool use_single_vertex, unsigned int g,
+                                                   bool score_cache, bool prefer_changed)
+{
+  if (score_cache && use_single_vertex) return std::make_shared<mh_single_vertex_cached>(prefer_changed);
+  if (score_cache) return std::make_shared<mh_vertices_swap_cached>();
+  if (!use_ppm && use_single_vertex) return make_specialized<mh_single_vertex_sbm_fixed, mh_single_vertex_sbm>(g);
+  if (use_ppm && use_single_vertex) return std::make_shared<mh_single_vertex_ppm>();
+  if (!use_ppm && !use_single_vertex) return make_specialized<mh_vertices_swap_sbm_fixed, mh_vertices_swap_sbm>(g);
+  return std::make_shared<mh_vertices_swap_ppm>();
+}
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 // virtual functions implementation
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 /* Implementation for the single vertex change (SBM) */
-std::vector<mcmc_move_t> mh_single_vertex_sbm::sample_proposal_distribution(blockmodel_t& blockmodel, std::mt19937& engine)
+std::vector<mcmc_move_t> mh_single_vertex_sbm::sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine)
 {
     return blockmodel.single_vertex_change(engine);
 }
-double mh_single_vertex_sbm::transition_ratio(const blockmodel_t& blockmodel, const float_mat_t& p, const std::vector<mcmc_move_t> moves)
+double mh_single_vertex_sbm::transition_ratio(const blockmodel_t& blockmodel, const float_mat_t& p, const std::vector<mcmc_move_t> & moves)
 {
-  int_vec_t ki = blockmodel.get_k(moves[0].vertex);
-  int_vec_t n = blockmodel.get_size_vector();
+  const int * ki = blockmodel.get_k_data(moves[0].vertex);
+  const int * n = blockmodel.get_size_data();
+  const unsigned int g = blockmodel.get_g();
   unsigned int r = moves[0].source;
   unsigned int s = moves[0].target;
   // Get the part of the probability associated to  block r and s.
@@ -118,9 +632,9 @@ double mh_single_vertex_sbm::transition_ratio(const blockmodel_t& blockmodel, co
              std::pow(p[r][s] / p[r][r], ki[r]) *
              std::pow(p[s][s] / p[r][s], ki[s]);
   // compute the rest
-  if (n.size() > 2)
+  if (g > 2)
   {
-    for (unsigned int l = 0; l < n.size(); ++l)
+    for (unsigned int l = 0; l < g; ++l)
     {
       if (l != r && l != s)
       {
@@ -132,29 +646,31 @@ double mh_single_vertex_sbm::transition_ratio(const blockmodel_t& blockmodel, co
   return a;
 }
 /* Implementation for the single vertex change (PPM) */
-std::vector<mcmc_move_t> mh_single_vertex_ppm::sample_proposal_distribution(blockmodel_t& blockmodel, std::mt19937& engine)
+std::vector<mcmc_move_t> mh_single_vertex_ppm::sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine)
 {
   return blockmodel.single_vertex_change(engine);
 }
-double mh_single_vertex_ppm::transition_ratio(const blockmodel_t& blockmodel, const float_mat_t& p, const std::vector<mcmc_move_t> moves)
+double mh_single_vertex_ppm::transition_ratio(const blockmodel_t& blockmodel, const float_mat_t& p, const std::vector<mcmc_move_t> & moves)
 {
-  int_vec_t ki = blockmodel.get_k(moves[0].vertex);
-  int_vec_t n = blockmodel.get_size_vector();
+  const int * ki = blockmodel.get_k_data(moves[0].vertex);
+  const int * n = blockmodel.get_size_data();
   unsigned int r = moves[0].source;
   unsigned int s = moves[0].target;
+  if (r == s) return 1;
   double a = std::pow((1 - p[0][0]) / (1 - p[0][1]), n[s] - ki[s] - n[r] + ki[r] + 1) *
              std::pow(p[0][0] / p[0][1], ki[s] - ki[r]);
   return a;
 }
 /* Implementation for the vertices swap (SBM) */
-std::vector<mcmc_move_t> mh_vertices_swap_sbm::sample_proposal_distribution(blockmodel_t& blockmodel, std::mt19937& engine)
+std::vector<mcmc_move_t> mh_vertices_swap_sbm::sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine)
 {
   return blockmodel.vertices_swap(engine);
 }
-double mh_vertices_swap_sbm::transition_ratio(const blockmodel_t& blockmodel, const float_mat_t& p, const std::vector<mcmc_move_t> moves)
+double mh_vertices_swap_sbm::transition_ratio(const blockmodel_t& blockmodel, const float_mat_t& p, const std::vector<mcmc_move_t> & moves)
 {
-  int_vec_t ki = blockmodel.get_k(moves[0].vertex);
-  int_vec_t kj = blockmodel.get_k(moves[1].vertex);
+  const int * ki = blockmodel.get_k_data(moves[0].vertex);
+  const int * kj = blockmodel.get_k_data(moves[1].vertex);
+  const unsigned int g = blockmodel.get_g();
   unsigned int r = moves[0].source;
   unsigned int s = moves[1].source;
   int a_xy = 0;
@@ -166,9 +682,9 @@ double mh_vertices_swap_sbm::transition_ratio(const blockmodel_t& blockmodel, co
   double a = std::pow((p[r][s] / p[r][r]) * (1 - p[r][r]) / (1 - p[r][s]), ki[r] - kj[r] + a_xy) *
              std::pow((p[s][s] / p[r][s]) * (1 - p[r][s]) / (1 - p[s][s]), ki[s] - kj[s] - a_xy);
   // compute the rest
-  if (ki.size() > 2)
+  if (g > 2)
   {
-    for (unsigned int l = 0; l < ki.size(); ++l)
+    for (unsigned int l = 0; l < g; ++l)
     {
       if (l != r && l != s)
       {
@@ -179,16 +695,17 @@ double mh_vertices_swap_sbm::transition_ratio(const blockmodel_t& blockmodel, co
   return a;
 }
 /* Implementation for the vertices swap (PPM) */
-std::vector<mcmc_move_t> mh_vertices_swap_ppm::sample_proposal_distribution(blockmodel_t& blockmodel, std::mt19937& engine)
+std::vector<mcmc_move_t> mh_vertices_swap_ppm::sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine)
 {
     return blockmodel.vertices_swap(engine);
 }
-double mh_vertices_swap_ppm::transition_ratio(const blockmodel_t& blockmodel, const float_mat_t& p, const std::vector<mcmc_move_t> moves)
+double mh_vertices_swap_ppm::transition_ratio(const blockmodel_t& blockmodel, const float_mat_t& p, const std::vector<mcmc_move_t> & moves)
 {
-    int_vec_t ki = blockmodel.get_k(moves[0].vertex);
-    int_vec_t kj = blockmodel.get_k(moves[1].vertex);
+    const int * ki = blockmodel.get_k_data(moves[0].vertex);
+    const int * kj = blockmodel.get_k_data(moves[1].vertex);
     unsigned int r = moves[0].source;
     unsigned int s = moves[1].source;
+    if (r == s) return 1;
     int a_xy = 0;
     if (blockmodel.are_connected(moves[0].vertex, moves[1].vertex)) {
         a_xy = 1;
@@ -198,3 +715,64 @@ double mh_vertices_swap_ppm::transition_ratio(const blockmodel_t& blockmodel, co
                std::pow((p[0][0] / p[0][1]) * (1 - p[0][1]) / (1 - p[0][0]), ki[s] - kj[s] - a_xy);
     return a;
 }
+/* Implementation for the cached ratios */
+std::vector<mcmc_move_t> mh_single_vertex_cached::sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine)
+{
+  blockmodel.track_changes(true);
+  unsigned int vertex;
+  toggle_ = !toggle_;
+  if (prefer_changed_ && toggle_ && blockmodel.pop_changed(vertex))
+  {
+    std::vector<mcmc_move_t> moves(1);
+    moves[0].vertex = vertex;
+    moves[0].source = blockmodel.get_membership(vertex);
+    moves[0].target = engine.uniform_int(blockmodel.get_g());
+    return moves;
+  }
+  return blockmodel.single_vertex_change(engine);
+}
+double mh_single_vertex_cached::transition_ratio(const blockmodel_t& blockmodel, const float_mat_t& p, const std::vector<mcmc_move_t> & moves)
+{
+  if (!blockmodel.is_tracking_changes()) return mh_single_vertex_sbm::transition_ratio(blockmodel, p, moves);
+  return std::exp(cache_.log_single_vertex_ratio(blockmodel, p, moves[0].vertex, moves[0].source, moves[0].target));
+}
+std::vector<mcmc_move_t> mh_vertices_swap_cached::sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine)
+{
+  blockmodel.track_changes(true);
+  return blockmodel.vertices_swap(engine);
+}
+double mh_vertices_swap_cached::transition_ratio(const blockmodel_t& blockmodel, const float_mat_t& p, const std::vector<mcmc_move_t> & moves)
+{
+  if (!blockmodel.is_tracking_changes()) return mh_vertices_swap_sbm::transition_ratio(blockmodel, p, moves);
+  return std::exp(cache_.log_vertices_swap_ratio(blockmodel, p, moves[0].vertex, moves[1].vertex,
+                                                 moves[0].source, moves[1].source));
+}
+void mh_single_vertex_cached::log_transition_ratios(const blockmodel_t& blockmodel, const float_mat_t& p,
+                                                    const std::vector<mcmc_move_t> & moves, unsigned int stride,
+                                                    double * log_ratios)
+{
+  if (!blockmodel.is_tracking_changes())
+  {
+    metropolis_hasting::log_transition_ratios(blockmodel, p, moves, stride, log_ratios);
+    return;
+  }
+  for (unsigned int c = 0; c < moves.size(); ++c)
+  {
+    log_ratios[c] = cache_.log_single_vertex_ratio(blockmodel, p, moves[c].vertex, moves[c].source, moves[c].target);
+  }
+}
+void mh_vertices_swap_cached::log_transition_ratios(const blockmodel_t& blockmodel, const float_mat_t& p,
+                                                    const std::vector<mcmc_move_t> & moves, unsigned int stride,
+                                                    double * log_ratios)
+{
+  if (!blockmodel.is_tracking_changes())
+  {
+    metropolis_hasting::log_transition_ratios(blockmodel, p, moves, stride, log_ratios);
+    return;
+  }
+  for (unsigned int c = 0; 2 * c < moves.size(); ++c)
+  {
+    log_ratios[c] = cache_.log_vertices_swap_ratio(blockmodel, p, moves[2 * c].vertex, moves[2 * c + 1].vertex,
+                                                   moves[2 * c].source, moves[2 * c + 1].source);
+  }
+}
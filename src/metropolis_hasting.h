@@ -2,79 +2,314 @@
 #define METROPOLIS_HASTING_H
 
 #include <cmath>
+#include <array>
 #include <vector>
-#include <iostream>
+#include <memory>
+#include <string>
 #include "types.h"
 #include "blockmodel.h"
-#include "output_functions.h"
+#include "random.h"
+#include "convergence.h"
+#include "marginal.h"
+#include "score_cache.h"
+#include "telemetry.h"
 
 /* Cooling schedules */
-double exponential_schedule(unsigned int t, float_vec_t cooling_schedule_kwargs);
-double linear_schedule(unsigned int t, float_vec_t cooling_schedule_kwargs);
-double logarithmic_schedule(unsigned int t, float_vec_t cooling_schedule_kwargs);
-double constant_schedule(unsigned int t, float_vec_t cooling_schedule_kwargs);
+double exponential_schedule(unsigned int t, const float_vec_t & cooling_schedule_kwargs);
+double linear_schedule(unsigned int t, const float_vec_t & cooling_schedule_kwargs);
+double logarithmic_schedule(unsigned int t, const float_vec_t & cooling_schedule_kwargs);
+double constant_schedule(unsigned int t, const float_vec_t & cooling_schedule_kwargs);
+typedef double (*cooling_schedule_t)(unsigned int, const float_vec_t &);
+/* Cooling schedule from its name. Returns nullptr for unknown names. */
+cooling_schedule_t get_cooling_schedule(const std::string & name);
+
+/* Log-likelihood of the current partition under the probability matrix p. */
+double log_likelihood(const blockmodel_t& blockmodel, const float_mat_t & p);
 
 class metropolis_hasting
 {
 protected:
-  std::uniform_real_distribution<> random_real;
+  history_callback_t history_;
+  unsigned int tries_;
+  log_probabilities_t log_p_;
+  std::vector<mcmc_move_t> candidates_;
+  std::vector<double> log_ratios_;
+  unsigned int sequential_degree_;
+  double sequential_tolerance_;
+  unsigned long early_decisions_;
+  unsigned long approximate_decisions_;
+  const float_mat_t * bounds_p_;
+  std::vector<double> bound_w_;  // max_l |w_sl - w_rl|, g x g
+  std::vector<double> bound_q_;  // max_l |q_sl - q_rl|, g x g
+  bool track_log_likelihood_;
+  double log_likelihood_change_;  // log ratio of the last step (0 if rejected), when tracked
+  bool null_move_;  // the last step proposed to move vertices to their own block
+
+  /* Sequential test of a single vertex move: the terms of blocks r and s first, then the other
+     blocks one at a time, until a bound on the remaining terms decides. */
+  bool sequential_test(const blockmodel_t& blockmodel, const float_mat_t & p, const mcmc_move_t & move,
+                       double temperature, rng_t& engine);
+  bool propose_and_accept(blockmodel_t& blockmodel, const float_mat_t & p, double temperature, rng_t& engine);
+
+  /// Telemetry
+  telemetry_t * telemetry_;
+  unsigned int chain_;
+  unsigned int generation_;     // generation of the last snapshot request served
+  unsigned long steps_;
+  unsigned long accepted_steps_;
+  const char * phase_;
+  unsigned long phase_begin_;
+  unsigned long phase_length_;
+  unsigned long reported_steps_;
+  unsigned long reported_accepted_steps_;
+  std::chrono::steady_clock::time_point reported_time_;
+  void begin_phase(const char * phase, unsigned long length)
+    {phase_ = phase; phase_begin_ = steps_; phase_length_ = length;}
+  void report(const blockmodel_t& blockmodel, const float_mat_t & p, double temperature);
 public:
-  // Ctor
-  metropolis_hasting() : random_real(0,1) {;}
+  metropolis_hasting() : tries_(1), sequential_degree_(0), sequential_tolerance_(0),
+                         early_decisions_(0), approximate_decisions_(0), bounds_p_(nullptr),
+                         track_log_likelihood_(false), log_likelihood_change_(0), null_move_(false),
+                         telemetry_(nullptr), chain_(0), generation_(0), steps_(0), accepted_steps_(0),
+                         phase_("idle"), phase_begin_(0), phase_length_(0),
+                         reported_steps_(0), reported_accepted_steps_(0) {}
+  virtual ~metropolis_hasting() {}
 
   // Virtual methods
-  virtual std::vector<mcmc_move_t> sample_proposal_distribution(blockmodel_t& blockmodel, std::mt19937& engine)
+  virtual std::vector<mcmc_move_t> sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine)
     {return std::vector<mcmc_move_t>();}  // bogus virtual implementation
-  virtual double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> moves)
+  virtual double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> & moves)
     {return 0;}  // bogus virtual implementation
+  /* Log transition ratios of a batch of candidates, stored one after the other in moves
+     (stride moves each: 1 for single vertex changes, 2 for vertices swaps).
+     Computed from log-probability tables: p must be strictly between 0 and 1. */
+  virtual void log_transition_ratios(const blockmodel_t& blockmodel, const float_mat_t & p,
+                                     const std::vector<mcmc_move_t> & moves, unsigned int stride,
+                                     double * log_ratios);
 
   // Common methods
+  /* Callback receiving the memberships of every sample, or of every annealing step. */
+  void set_history(history_callback_t history) {history_ = history;}
+  /* Number of candidates of every step. With more than one, the steps are multiple-try Metropolis steps. */
+  void set_multiple_tries(unsigned int tries) {tries_ = tries;}
+  /* Decide the single vertex moves of the vertices of degree at least degree (0 to disable) with a sequential
+     test. Decisions are exact, except when the acceptance probability is known within tolerance, in which
+     case the move is accepted if the partial log ratio is above the threshold (an approximate decision). */
+  void set_sequential_test(unsigned int degree, double tolerance)
+    {sequential_degree_ = degree; sequential_tolerance_ = tolerance;}
+  /* Publish snapshots of the chain to telemetry when requested (nullptr to stop). */
+  void set_telemetry(telemetry_t * telemetry, unsigned int chain=0);
+  unsigned long get_early_decisions() const {return early_decisions_;}
+  unsigned long get_approximate_decisions() const {return approximate_decisions_;}
   bool step(blockmodel_t& blockmodel,
             const float_mat_t & p,
             double temperature,
-            std::mt19937 & engine);
+            rng_t& engine);
+  /* Multiple-try Metropolis step (Liu, Liang & Wong, 2000) with tries candidates weighted by their
+     tempered probability. The candidates are scored in one batch. At zero temperature, the best
+     candidate is taken if it does not lower the log-likelihood (the greedy limit). */
+  bool step_multiple_try(blockmodel_t& blockmodel,
+                         const float_mat_t & p,
+                         double temperature,
+                         unsigned int tries,
+                         rng_t& engine);
   double marginalize(blockmodel_t& blockmodel,
-                     uint_mat_t & marginal_distribution,
+                     marginal_accumulator_t & marginal_distribution,
                      const float_mat_t & p,
                      unsigned int burn_in_time,
                      unsigned int sampling_frequency,
                      unsigned int num_samples,
-                     std::mt19937& engine);
+                     rng_t& engine);
+  /* Marginalize with burn-in, thinning and number of samples chosen from online
+     diagnostics of the log-likelihood trace. At most max_steps steps are used; if they run out
+     during the burn-in, no sample is taken (convergence.num_samples is 0). */
+  double marginalize_adaptive(blockmodel_t& blockmodel,
+                              marginal_accumulator_t & marginal_distribution,
+                              const float_mat_t & p,
+                              unsigned int min_burn_in,
+                              unsigned int max_steps,
+                              unsigned int target_ess,
+                              double r_hat_threshold,
+                              double stability_threshold,
+                              convergence_t & convergence,
+                              rng_t& engine);
   void anneal(blockmodel_t& blockmodel,
               const float_mat_t & p,
-              double (*cooling_schedule)(unsigned int, float_vec_t),
-              float_vec_t cooling_schedule_kwargs,
+              cooling_schedule_t cooling_schedule,
+              const float_vec_t & cooling_schedule_kwargs,
               unsigned int duration,
-              std::mt19937& engine);
+              rng_t& engine);
+  /* Simulated annealing with a temperature controlled by the acceptance rate.
+     The target acceptance rate of sweep k (N steps) is a_0 * alpha^k, where a_0 is the acceptance
+     rate of the first sweep, at initial_temperature. After every sweep, the temperature is
+     multiplied by exp(target - observed acceptance rate), down to initial_temperature * 1e-6.
+     The acceptance rates leave out the null moves (a vertex to its own block, or a swap within
+     a block), which are always accepted.
+     Stops after patience sweeps without improvement of the log-likelihood, or after duration steps.
+     The blockmodel is left in the best state seen at the end of a sweep, whose log-likelihood is returned. */
+  double anneal_adaptive(blockmodel_t& blockmodel,
+                         const float_mat_t & p,
+                         double initial_temperature,
+                         double alpha,
+                         unsigned int patience,
+                         unsigned int duration,
+                         rng_t& engine);
 };
 
 /* Inherited classes with specific definitions */
 class mh_single_vertex_sbm : public metropolis_hasting
 {
 public:
-  std::vector<mcmc_move_t> sample_proposal_distribution(blockmodel_t& blockmodel, std::mt19937& engine);
-  double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> moves);
+  std::vector<mcmc_move_t> sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine);
+  double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> & moves);
 };
 
 class mh_single_vertex_ppm : public metropolis_hasting
 {
 public:
-  std::vector<mcmc_move_t> sample_proposal_distribution(blockmodel_t& blockmodel, std::mt19937& engine);
-  double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> moves);
+  std::vector<mcmc_move_t> sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine);
+  double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> & moves);
 };
 
 class mh_vertices_swap_sbm : public metropolis_hasting
 {
 public:
-  std::vector<mcmc_move_t> sample_proposal_distribution(blockmodel_t& blockmodel, std::mt19937& engine);
-  double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> moves);
+  std::vector<mcmc_move_t> sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine);
+  double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> & moves);
 };
 
 class mh_vertices_swap_ppm : public metropolis_hasting
 {
 public:
-  std::vector<mcmc_move_t> sample_proposal_distribution(blockmodel_t& blockmodel, std::mt19937& engine);
-  double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> moves);
+  std::vector<mcmc_move_t> sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine);
+  double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> & moves);
+};
+
+/* Specializations for a number of blocks G known at compile time.
+   The ratios are computed in log space from tables of fixed size, in loops without branches that the
+   compiler unrolls. When p has entries equal to 0 or 1, the generic ratios are used instead. */
+template<unsigned int G>
+class fixed_log_probabilities_t
+{
+public:
+  fixed_log_probabilities_t() : p_(nullptr), finite_(false) {}
+  /* Recompute the tables if p is not the matrix they were computed from (by address).
+     Returns false if p has entries equal to 0 or 1, whose logarithms are not finite. */
+  bool update(const float_mat_t & p)
+  {
+    if (p_ != &p)
+    {
+      p_ = &p;
+      finite_ = true;
+      for (unsigned int l = 0; l < G; ++l)
+      {
+        for (unsigned int t = 0; t < G; ++t)
+        {
+          finite_ = finite_ && p[l][t] > 0 && p[l][t] < 1;
+          q[l][t] = std::log(1 - (double) p[l][t]);
+          w[l][t] = std::log((double) p[l][t]) - q[l][t];
+        }
+      }
+    }
+    return finite_;
+  }
+  std::array<std::array<double, G>, G> w;  // log(p_lt / (1 - p_lt))
+  std::array<std::array<double, G>, G> q;  // log(1 - p_lt)
+private:
+  const float_mat_t * p_;
+  bool finite_;
+};
+
+/* log ratio = sum_l k_l (w_sl - w_rl) + n_l (q_sl - q_rl) - q_sr + q_rr (0 when r == s) */
+template<unsigned int G>
+double single_vertex_sbm_log_ratio(const int * k, const int * n, const fixed_log_probabilities_t<G> & log_p,
+                                   unsigned int r, unsigned int s)
+{
+  double x = log_p.q[r][r] - log_p.q[s][r];
+  for (unsigned int l = 0; l < G; ++l)
+  {
+    x += k[l] * (log_p.w[s][l] - log_p.w[r][l]) + n[l] * (log_p.q[s][l] - log_p.q[r][l]);
+  }
+  return x;
+}
+/* log ratio = sum_l (ki_l - kj_l) (w_sl - w_rl) + a_ij (2 w_rs - w_rr - w_ss) (0 when r == s) */
+template<unsigned int G>
+double vertices_swap_sbm_log_ratio(const int * ki, const int * kj, int a_xy,
+                                   const fixed_log_probabilities_t<G> & log_p, unsigned int r, unsigned int s)
+{
+  double x = a_xy * (2 * log_p.w[r][s] - log_p.w[r][r] - log_p.w[s][s]);
+  for (unsigned int l = 0; l < G; ++l)
+  {
+    x += (ki[l] - kj[l]) * (log_p.w[s][l] - log_p.w[r][l]);
+  }
+  return x;
+}
+
+template<unsigned int G>
+class mh_single_vertex_sbm_fixed : public mh_single_vertex_sbm
+{
+public:
+  double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> & moves)
+  {
+    if (!fixed_log_p_.update(p)) return mh_single_vertex_sbm::transition_ratio(blockmodel, p, moves);
+    return std::exp(single_vertex_sbm_log_ratio<G>(blockmodel.get_k_data(moves[0].vertex), blockmodel.get_size_data(),
+                                                   fixed_log_p_, moves[0].source, moves[0].target));
+  }
+private:
+  fixed_log_probabilities_t<G> fixed_log_p_;
 };
 
+template<unsigned int G>
+class mh_vertices_swap_sbm_fixed : public mh_vertices_swap_sbm
+{
+public:
+  double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> & moves)
+  {
+    if (!fixed_log_p_.update(p)) return mh_vertices_swap_sbm::transition_ratio(blockmodel, p, moves);
+    int a_xy = blockmodel.are_connected(moves[0].vertex, moves[1].vertex) ? 1 : 0;
+    return std::exp(vertices_swap_sbm_log_ratio<G>(blockmodel.get_k_data(moves[0].vertex),
+                                                   blockmodel.get_k_data(moves[1].vertex), a_xy,
+                                                   fixed_log_p_, moves[0].source, moves[1].source));
+  }
+private:
+  fixed_log_probabilities_t<G> fixed_log_p_;
+};
+
+/* Ratios computed from a score cache (any probability matrix strictly between 0 and 1).
+   With prefer_changed, every other single vertex proposal goes to the vertex whose neighbourhood
+   changed the earliest, when there is one. This breaks detailed balance: maximization only. */
+class mh_single_vertex_cached : public mh_single_vertex_sbm
+{
+public:
+  mh_single_vertex_cached(bool prefer_changed=false) : prefer_changed_(prefer_changed), toggle_(false) {}
+  std::vector<mcmc_move_t> sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine);
+  double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> & moves);
+  void log_transition_ratios(const blockmodel_t& blockmodel, const float_mat_t & p,
+                             const std::vector<mcmc_move_t> & moves, unsigned int stride, double * log_ratios);
+  const score_cache_t & get_cache() const {return cache_;}
+private:
+  score_cache_t cache_;
+  bool prefer_changed_;
+  bool toggle_;
+};
+
+class mh_vertices_swap_cached : public mh_vertices_swap_sbm
+{
+public:
+  std::vector<mcmc_move_t> sample_proposal_distribution(blockmodel_t& blockmodel, rng_t& engine);
+  double transition_ratio(const blockmodel_t& blockmodel, const float_mat_t & p, const std::vector<mcmc_move_t> & moves);
+  void log_transition_ratios(const blockmodel_t& blockmodel, const float_mat_t & p,
+                             const std::vector<mcmc_move_t> & moves, unsigned int stride, double * log_ratios);
+  const score_cache_t & get_cache() const {return cache_;}
+private:
+  score_cache_t cache_;
+};
+
+/* Algorithm for a choice of transition ratios and proposal distribution.
+   The SBM ratios are specialized at compile time for 2 to 8 blocks. With score_cache, the cached
+   ratios are used instead for any number of blocks (and any p, use_ppm is then irrelevant), and
+   prefer_changed is passed to the single vertex proposals. */
+std::shared_ptr<metropolis_hasting> make_algorithm(bool use_ppm, bool use_single_vertex, unsigned int g,
+                                                   bool score_cache=false, bool prefer_changed=false);
+
 #endif // METROPOLIS_HASTING_H
\ No newline at end of file
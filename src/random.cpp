@@ -0,0 +1,113 @@
+#include "random.h"
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Mersenne-twister
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+static std::mt19937 seeded_mt19937(unsigned int seed, unsigned int stream)
+{
+  if (stream == 0) return std::mt19937(seed);
+  std::seed_seq sequence = {seed, stream};
+  return std::mt19937(sequence);
+}
+
+mt19937_rng_t::mt19937_rng_t(unsigned int seed, unsigned int stream) :
+engine_(seeded_mt19937(seed, stream))
+{
+}
+
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// xoshiro256++
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// Reference implementation: http://prng.di.unimi.it/xoshiro256plusplus.c
+static const std::uint64_t jump_polynomial[4] =
+  {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+static const std::uint64_t long_jump_polynomial[4] =
+  {0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL, 0x77710069854ee241ULL, 0x39109bb02acbe635ULL};
+
+static inline std::uint64_t rotl(std::uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static std::uint64_t splitmix64(std::uint64_t & x)
+{
+  std::uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+xoshiro_rng_t::xoshiro_rng_t(unsigned int seed, unsigned int stream) :
+position_(batch)
+{
+  std::uint64_t x = seed;
+  for (unsigned int w = 0; w < 4; ++w)
+  {
+    state_[w][0] = splitmix64(x);
+  }
+  for (unsigned int i = 0; i < stream; ++i)
+  {
+    jump(long_jump_polynomial, 0);
+  }
+  for (unsigned int l = 1; l < lanes; ++l)
+  {
+    for (unsigned int w = 0; w < 4; ++w)
+    {
+      state_[w][l] = state_[w][l - 1];
+    }
+    jump(jump_polynomial, l);
+  }
+}
+
+void xoshiro_rng_t::refill()
+{
+  // The lanes are independent: the inner loop is a SIMD loop over the lanes.
+  for (unsigned int i = 0; i < batch; i += lanes)
+  {
+    for (unsigned int l = 0; l < lanes; ++l)
+    {
+      buffer_[i + l] = rotl(state_[0][l] + state_[3][l], 23) + state_[0][l];
+      std::uint64_t t = state_[1][l] << 17;
+      state_[2][l] ^= state_[0][l];
+      state_[3][l] ^= state_[1][l];
+      state_[1][l] ^= state_[2][l];
+      state_[0][l] ^= state_[3][l];
+      state_[2][l] ^= t;
+      state_[3][l] = rotl(state_[3][l], 45);
+    }
+  }
+  position_ = 0;
+}
+
+void xoshiro_rng_t::jump(const std::uint64_t (&polynomial)[4], unsigned int lane)
+{
+  std::uint64_t s[4] = {0, 0, 0, 0};
+  std::uint64_t * lane_state[4] = {&state_[0][lane], &state_[1][lane], &state_[2][lane], &state_[3][lane]};
+  for (unsigned int i = 0; i < 4; ++i)
+  {
+    for (unsigned int b = 0; b < 64; ++b)
+    {
+      if (polynomial[i] & (1ULL << b))
+      {
+        for (unsigned int w = 0; w < 4; ++w) s[w] ^= *lane_state[w];
+      }
+      std::uint64_t t = *lane_state[1] << 17;
+      *lane_state[2] ^= *lane_state[0];
+      *lane_state[3] ^= *lane_state[1];
+      *lane_state[1] ^= *lane_state[2];
+      *lane_state[0] ^= *lane_state[3];
+      *lane_state[2] ^= t;
+      *lane_state[3] = rotl(*lane_state[3], 45);
+    }
+  }
+  for (unsigned int w = 0; w < 4; ++w) *lane_state[w] = s[w];
+}
+
+
+std::unique_ptr<rng_t> make_rng(const std::string & name, unsigned int seed, unsigned int stream)
+{
+  if (name == "mt19937") return std::unique_ptr<rng_t>(new mt19937_rng_t(seed, stream));
+  if (name == "xoshiro256") return std::unique_ptr<rng_t>(new xoshiro_rng_t(seed, stream));
+  return std::unique_ptr<rng_t>();
+}
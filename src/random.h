@@ -0,0 +1,87 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+
+/* Random number generator interface.
+   Also a UniformRandomBitGenerator (32 bits), so that it can be passed to std::shuffle. */
+class rng_t
+{
+public:
+  typedef std::uint32_t result_type;
+  static constexpr result_type min() {return 0;}
+  static constexpr result_type max() {return 0xFFFFFFFF;}
+  virtual ~rng_t() {}
+
+  virtual result_type operator()() = 0;
+  /* Uniform integer in [0, n). n must be positive. */
+  virtual unsigned int uniform_int(unsigned int n) = 0;
+  /* Uniform real in [0, 1). */
+  virtual double uniform_real() = 0;
+};
+
+/* Mersenne-twister 19937 with the standard distributions.
+   Stream 0 reproduces the draws of std::mt19937(seed) exactly. */
+class mt19937_rng_t : public rng_t
+{
+public:
+  mt19937_rng_t(unsigned int seed, unsigned int stream=0);
+
+  result_type operator()() {return engine_();}
+  unsigned int uniform_int(unsigned int n) {return std::uniform_int_distribution<>(0, n - 1)(engine_);}
+  double uniform_real() {return std::uniform_real_distribution<>(0, 1)(engine_);}
+
+private:
+  std::mt19937 engine_;
+};
+
+/* xoshiro256++ (Blackman & Vigna), run as 4 interleaved lanes so that the
+   generation of a batch of numbers vectorizes. The lanes are 2^128 steps apart,
+   and the streams 2^192 steps apart, in the sequence seeded from splitmix64(seed). */
+class xoshiro_rng_t : public rng_t
+{
+public:
+  static const unsigned int lanes = 4;
+  static const unsigned int batch = 256;
+
+  xoshiro_rng_t(unsigned int seed, unsigned int stream=0);
+
+  result_type operator()() {return next() >> 32;}
+  unsigned int uniform_int(unsigned int n)
+  {
+    // Lemire's multiply-shift, with rejection of the biased low products.
+    std::uint64_t m = (next() >> 32) * (std::uint64_t) n;
+    if ((std::uint32_t) m < n)
+    {
+      std::uint32_t threshold = (0u - n) % n;
+      while ((std::uint32_t) m < threshold)
+      {
+        m = (next() >> 32) * (std::uint64_t) n;
+      }
+    }
+    return m >> 32;
+  }
+  double uniform_real() {return (next() >> 11) * (1.0 / 9007199254740992.0);}  // 53 bits
+
+private:
+  std::uint64_t state_[4][lanes];  // state word, then lane
+  std::uint64_t buffer_[batch];
+  unsigned int position_;
+
+  std::uint64_t next()
+  {
+    if (position_ == batch) refill();
+    return buffer_[position_++];
+  }
+  void refill();
+  /* Advance every lane by 2^128 (jump) or 2^192 (long jump) steps. */
+  void jump(const std::uint64_t (&polynomial)[4], unsigned int lane);
+};
+
+/* Generator from its name (mt19937 or xoshiro256). Returns nullptr for unknown names. */
+std::unique_ptr<rng_t> make_rng(const std::string & name, unsigned int seed, unsigned int stream=0);
+
+#endif // RANDOM_H
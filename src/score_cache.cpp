@@ -0,0 +1,96 @@
+#include <cmath>
+#include "score_cache.h"
+
+
+bool log_probabilities_t::update(const float_mat_t & p)
+{
+  if (&p == p_ && p.size() == g_) return false;
+  p_ = &p;
+  g_ = p.size();
+  w_.resize(g_ * g_);
+  q_.resize(g_ * g_);
+  for (unsigned int l = 0; l < g_; ++l)
+  {
+    for (unsigned int t = 0; t < g_; ++t)
+    {
+      q_[l * g_ + t] = std::log(1 - (double) p[l][t]);
+      w_[l * g_ + t] = std::log((double) p[l][t]) - q_[l * g_ + t];
+    }
+  }
+  return true;
+}
+
+
+score_cache_t::score_cache_t() : epoch_(0), g_(0) {}
+
+double score_cache_t::log_single_vertex_ratio(const blockmodel_t& blockmodel, const float_mat_t & p,
+                                              unsigned int vertex, unsigned int r, unsigned int s)
+{
+  prepare(blockmodel, p);
+  const double * a = scores(blockmodel, vertex);
+  return a[s] - a[r] + b_[s] - b_[r] - log_p_.q(s)[r] + log_p_.q(r)[r];
+}
+
+double score_cache_t::log_vertices_swap_ratio(const blockmodel_t& blockmodel, const float_mat_t & p,
+                                              unsigned int i, unsigned int j, unsigned int r, unsigned int s)
+{
+  if (r == s) return 0;
+  prepare(blockmodel, p);
+  const double * ai = scores(blockmodel, i);
+  const double * aj = scores(blockmodel, j);
+  double x = ai[s] - ai[r] - aj[s] + aj[r];
+  if (blockmodel.are_connected(i, j))
+  {
+    x += 2 * log_p_.w(r)[s] - log_p_.w(r)[r] - log_p_.w(s)[s];
+  }
+  return x;
+}
+
+void score_cache_t::prepare(const blockmodel_t& blockmodel, const float_mat_t & p)
+{
+  const int * n = blockmodel.get_size_data();
+  bool rebuild = log_p_.update(p);
+  if (rebuild || blockmodel.get_epoch() != epoch_ || blockmodel.get_N() * blockmodel.get_g() != a_.size())
+  {
+    epoch_ = blockmodel.get_epoch();
+    g_ = blockmodel.get_g();
+    a_.assign(blockmodel.get_N() * g_, 0);
+    version_.assign(blockmodel.get_N(), 0);
+    valid_.assign(blockmodel.get_N(), 0);
+    b_.assign(g_, 0);
+    n_.assign(g_, 0);
+  }
+  // Update B with the changes of the block sizes, O(g) per block that changed.
+  for (unsigned int t = 0; t < g_; ++t)
+  {
+    if (n[t] != n_[t])
+    {
+      double dn = n[t] - n_[t];
+      for (unsigned int l = 0; l < g_; ++l)
+      {
+        b_[l] += dn * log_p_.q(l)[t];
+      }
+      n_[t] = n[t];
+    }
+  }
+}
+
+const double * score_cache_t::scores(const blockmodel_t& blockmodel, unsigned int vertex)
+{
+  double * a = &a_[vertex * g_];
+  if (valid_[vertex] && version_[vertex] == blockmodel.get_version(vertex)) return a;
+  const int * k = blockmodel.get_k_data(vertex);
+  for (unsigned int l = 0; l < g_; ++l)
+  {
+    const double * w = log_p_.w(l);
+    double x = 0;
+    for (unsigned int t = 0; t < g_; ++t)
+    {
+      x += k[t] * w[t];
+    }
+    a[l] = x;
+  }
+  version_[vertex] = blockmodel.get_version(vertex);
+  valid_[vertex] = 1;
+  return a;
+}
@@ -0,0 +1,59 @@
+#ifndef SCORE_CACHE_H
+#define SCORE_CACHE_H
+
+#include <vector>
+#include "types.h"
+#include "blockmodel.h"
+
+/* Tables of w_lt = log(p_lt / (1 - p_lt)) and q_lt = log(1 - p_lt), g x g in row major order. */
+class log_probabilities_t
+{
+public:
+  log_probabilities_t() : p_(nullptr), g_(0) {}
+  /* Recompute the tables if p is not the matrix they were computed from (by address, so changes of p
+     in place are not detected). Returns true if they were recomputed. */
+  bool update(const float_mat_t & p);
+  const double * w(unsigned int l) const {return &w_[l * g_];}
+  const double * q(unsigned int l) const {return &q_[l * g_];}
+
+private:
+  const float_mat_t * p_;
+  unsigned int g_;
+  std::vector<double> w_;
+  std::vector<double> q_;
+};
+
+/* Cache of the per-block log-scores of the vertices.
+   With w_lt = log(p_lt / (1 - p_lt)) and q_lt = log(1 - p_lt), the score of vertex v for block l is
+   A_v(l) = sum_t k_vt w_lt, and the block size term is B(l) = sum_t n_t q_lt. Then
+     log ratio of the move of v from r to s        = A_v(s) - A_v(r) + B(s) - B(r) - q_sr + q_rr,
+     log ratio of the swap of i (in r) and j (in s) = A_i(s) - A_i(r) - A_j(s) + A_j(r) + a_ij (2 w_rs - w_rr - w_ss).
+   A_v is recomputed only when the version of v in the blockmodel changed, that is when a neighbour
+   of v moved, and B is updated with the block sizes. The blockmodel must track changes and the
+   probabilities must lie strictly between 0 and 1. */
+class score_cache_t
+{
+public:
+  score_cache_t();
+
+  double log_single_vertex_ratio(const blockmodel_t& blockmodel, const float_mat_t & p,
+                                 unsigned int vertex, unsigned int r, unsigned int s);
+  double log_vertices_swap_ratio(const blockmodel_t& blockmodel, const float_mat_t & p,
+                                 unsigned int i, unsigned int j, unsigned int r, unsigned int s);
+
+private:
+  unsigned long epoch_;        // epoch of the blockmodel the scores belong to
+  unsigned int g_;
+  log_probabilities_t log_p_;
+  std::vector<double> a_;      // N x g, scores of the vertices
+  uint_vec_t version_;         // version of the vertices when their scores were computed
+  std::vector<char> valid_;
+  std::vector<double> b_;      // g
+  int_vec_t n_;                // block sizes of b_
+
+  /* Rebuild the cache if the epoch of the blockmodel or p changed, and bring B up to date. */
+  void prepare(const blockmodel_t& blockmodel, const float_mat_t & p);
+  const double * scores(const blockmodel_t& blockmodel, unsigned int vertex);
+};
+
+#endif // SCORE_CACHE_H
@@ -0,0 +1,107 @@
+#include <csignal>
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+#include "telemetry.h"
+
+
+static std::atomic<unsigned int> * signal_generation = nullptr;
+
+static void on_sigusr1(int)
+{
+  if (signal_generation != nullptr) signal_generation->fetch_add(1, std::memory_order_relaxed);
+}
+
+/* JSON number, or null if it is not finite. */
+static void output_number(std::ostream & output, double x)
+{
+  if (std::isfinite(x)) output << x;
+  else output << "null";
+}
+
+telemetry_t::telemetry_t() : generation_(0), stopping_(false) {}
+
+telemetry_t::~telemetry_t()
+{
+  stop();
+  if (signal_generation == &generation_)
+  {
+    std::signal(SIGUSR1, SIG_DFL);
+    signal_generation = nullptr;
+  }
+}
+
+bool telemetry_t::start(const std::string & path, double every_seconds, std::string & error)
+{
+  output_.open(path.c_str(), std::ios::app);
+  if (!output_.is_open())
+  {
+    error = "Could not open the stats file " + path + ".\n";
+    return false;
+  }
+  output_.precision(10);
+  start_time_ = std::chrono::steady_clock::now();
+  if (every_seconds > 0)
+  {
+    stopping_ = false;
+    reporter_ = std::thread([this, every_seconds]()
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (!wake_.wait_for(lock, std::chrono::duration<double>(every_seconds), [this]() {return stopping_;}))
+      {
+        request();
+      }
+    });
+  }
+  return true;
+}
+
+void telemetry_t::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_all();
+  if (reporter_.joinable()) reporter_.join();
+}
+
+void telemetry_t::handle_signal()
+{
+  signal_generation = &generation_;
+  std::signal(SIGUSR1, &on_sigusr1);
+}
+
+void telemetry_t::publish(const telemetry_snapshot_t & snapshot)
+{
+  double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time_).count();
+  unsigned long rss = resident_set_size();
+  std::lock_guard<std::mutex> lock(mutex_);
+  output_ << "{\"time\": " << time
+          << ", \"chain\": " << snapshot.chain
+          << ", \"step\": " << snapshot.step
+          << ", \"phase\": \"" << snapshot.phase << "\""
+          << ", \"phase_step\": " << snapshot.phase_step
+          << ", \"phase_length\": " << snapshot.phase_length
+          << ", \"temperature\": ";
+  output_number(output_, snapshot.temperature);
+  output_ << ", \"steps_per_second\": ";
+  output_number(output_, snapshot.steps_per_second);
+  output_ << ", \"acceptance_rate\": ";
+  output_number(output_, snapshot.acceptance_rate);
+  output_ << ", \"log_likelihood\": ";
+  output_number(output_, snapshot.log_likelihood);
+  output_ << ", \"rss_bytes\": " << rss << "}" << std::endl;
+}
+
+unsigned long resident_set_size()
+{
+  std::FILE * statm = std::fopen("/proc/self/statm", "r");
+  if (statm == nullptr) return 0;
+  unsigned long size = 0;
+  unsigned long resident = 0;
+  int read = std::fscanf(statm, "%lu %lu", &size, &resident);
+  std::fclose(statm);
+  if (read != 2) return 0;
+  return resident * (unsigned long) sysconf(_SC_PAGESIZE);
+}
@@ -0,0 +1,60 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/* State of a sampler when a snapshot is requested. */
+typedef struct telemetry_snapshot_t
+{
+  unsigned int chain;             // 0 for the main chain, i for the i-th restart
+  unsigned long step;             // steps of the chain so far
+  const char * phase;             // burn_in, sampling or annealing
+  unsigned long phase_step;       // steps of the current phase so far
+  unsigned long phase_length;     // planned steps of the phase (an upper bound for the adaptive modes)
+  double temperature;
+  double steps_per_second;        // since the previous snapshot of the chain
+  double acceptance_rate;         // since the previous snapshot of the chain
+  double log_likelihood;
+} telemetry_snapshot_t;
+
+/* Snapshots of running samplers, written as one JSON line each.
+   A request (SIGUSR1 or the periodic reporter) increments a generation counter, which the samplers
+   compare to the last generation they reported with a relaxed load at every step. */
+class telemetry_t
+{
+public:
+  telemetry_t();
+  ~telemetry_t();
+
+  /* Append the snapshots to path, and request one every every_seconds if positive.
+     Returns false and explains why in error if the file cannot be opened. */
+  bool start(const std::string & path, double every_seconds, std::string & error);
+  void stop();
+  /* Request a snapshot on SIGUSR1. A single telemetry_t can handle the signal at a time. */
+  void handle_signal();
+
+  void request() {generation_.fetch_add(1, std::memory_order_relaxed);}
+  unsigned int get_generation() const {return generation_.load(std::memory_order_relaxed);}
+  /* Write a snapshot. Thread safe. */
+  void publish(const telemetry_snapshot_t & snapshot);
+
+private:
+  std::atomic<unsigned int> generation_;
+  std::mutex mutex_;
+  std::ofstream output_;
+  std::chrono::steady_clock::time_point start_time_;
+  std::thread reporter_;
+  std::condition_variable wake_;
+  bool stopping_;
+};
+
+/* Resident set size of the process in bytes, 0 if unknown. */
+unsigned long resident_set_size();
+
+#endif // TELEMETRY_H
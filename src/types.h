@@ -4,6 +4,7 @@
 #include <vector>
 #include <set>
 #include <utility>
+#include <functional>
 
 typedef std::pair<unsigned int, unsigned int> edge_t;
 typedef std::vector<edge_t> edge_list_t;
@@ -25,4 +26,6 @@ typedef std::vector< std::vector<unsigned int> > uint_mat_t;
 typedef std::vector< std::vector<int> > int_mat_t;
 typedef std::vector< std::vector<float> > float_mat_t;
 
+typedef std::function<void(const uint_vec_t &)> history_callback_t;
+
 #endif // TYPES_H
\ No newline at end of file
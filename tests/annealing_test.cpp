@@ -0,0 +1,74 @@
+/* Annealing down to zero temperature, where the multiple-try steps must take the greedy limit
+   instead of freezing on infinite weights. */
+
+#include <cmath>
+#include <sstream>
+#include "test_utilities.h"
+
+static const unsigned int N = 40;
+
+/* Two planted blocks of N / 2 vertices, with probabilities 0.6 inside and 0.1 across. */
+static adj_list_t planted_graph(unsigned int seed)
+{
+  mt19937_rng_t engine(seed);
+  edge_list_t edge_list;
+  for (unsigned int i = 0; i < N; ++i)
+  {
+    for (unsigned int j = i + 1; j < N; ++j)
+    {
+      double p = ((i < N / 2) == (j < N / 2)) ? 0.6 : 0.1;
+      if (engine.uniform_real() < p) edge_list.push_back(edge_t(i, j));
+    }
+  }
+  return edge_to_adj(edge_list, N);
+}
+
+static void check_annealing(bool use_single_vertex, unsigned int tries, unsigned int seed)
+{
+  adj_list_t adj_list = planted_graph(seed);
+  float_mat_t p = {{0.6f, 0.1f}, {0.1f, 0.6f}};
+  uint_vec_t planted(N, 0);
+  for (unsigned int i = N / 2; i < N; ++i) planted[i] = 1;
+  blockmodel_t planted_state(planted, 2, N, &adj_list);
+  double planted_log_likelihood = log_likelihood(planted_state, p);
+
+  mt19937_rng_t engine(seed + 1);
+  blockmodel_t blockmodel(planted, 2, N, &adj_list);
+  blockmodel.shuffle(engine);
+  std::shared_ptr<metropolis_hasting> algorithm = make_algorithm(false, use_single_vertex, 2);
+  algorithm->set_multiple_tries(tries);
+  std::ostringstream name;
+  name << (use_single_vertex ? "single vertex" : "vertices swap") << ", " << tries << " tries, seed " << seed;
+
+  // The exponential schedule underflows to T = 0 after about 80 steps.
+  algorithm->anneal(blockmodel, p, &exponential_schedule, {1.f, 0.0001f}, 20000, engine);
+  double ll = log_likelihood(blockmodel, p);
+  check(ll >= planted_log_likelihood, "annealing (" + name.str() + ") did not reach the planted partition");
+
+  // Steps at T = 0 never lower the log-likelihood.
+  blockmodel.shuffle(engine);
+  ll = log_likelihood(blockmodel, p);
+  bool monotone = true;
+  for (unsigned int t = 0; t < 5000; ++t)
+  {
+    algorithm->step(blockmodel, p, 0, engine);
+    double next = log_likelihood(blockmodel, p);
+    monotone = monotone && next >= ll - 1e-12 * std::abs(ll);  // ties between swaps, summed in another order
+    ll = next;
+  }
+  check(monotone, "steps at zero temperature (" + name.str() + ") lowered the log-likelihood");
+  check(ll > planted_log_likelihood - 50, "steps at zero temperature (" + name.str() + ") froze");
+}
+
+int main()
+{
+  for (unsigned int seed = 1; seed <= 3; ++seed)
+  {
+    for (unsigned int tries = 1; tries <= 4; tries += 3)
+    {
+      check_annealing(true, tries, seed);
+      check_annealing(false, tries, seed);
+    }
+  }
+  return test_result();
+}
@@ -0,0 +1,128 @@
+/* Cross-check of every transition ratio implementation against the difference of the
+   log-likelihoods, computed from get_m(), before and after the moves. */
+
+#include <memory>
+#include <sstream>
+#include "test_utilities.h"
+
+typedef struct ratio_case_t
+{
+  std::string name;
+  bool use_ppm;
+  bool use_single_vertex;
+  bool score_cache;
+  bool generic;  // the implementation for any number of blocks, instead of the one chosen by make_algorithm
+} ratio_case_t;
+
+static std::shared_ptr<metropolis_hasting> make_case_algorithm(const ratio_case_t & test, unsigned int g)
+{
+  if (test.generic && test.use_single_vertex) return std::make_shared<mh_single_vertex_sbm>();
+  if (test.generic) return std::make_shared<mh_vertices_swap_sbm>();
+  return make_algorithm(test.use_ppm, test.use_single_vertex, g, test.score_cache);
+}
+
+static double brute_force_log_ratio(const blockmodel_t & blockmodel, const float_mat_t & p,
+                                    const std::vector<mcmc_move_t> & moves)
+{
+  blockmodel_t moved(blockmodel);
+  moved.apply_mcmc_moves(moves);
+  return log_likelihood(moved, p) - log_likelihood(blockmodel, p);
+}
+
+/* The pow kernels work on single precision ratios of probabilities. */
+static bool close(double a, double b)
+{
+  return std::fabs(a - b) <= 1e-5 * (1 + std::fabs(b));
+}
+
+static void check_ratios(const ratio_case_t & test, unsigned int g, unsigned int seed)
+{
+  const unsigned int N = 40;
+  adj_list_t adj_list = random_graph(N, 0.2, seed);
+  float_mat_t p = random_probabilities(g, test.use_ppm, seed + 1);
+  mt19937_rng_t engine(seed + 2);
+  uint_vec_t memberships(N);
+  for (unsigned int i = 0; i < N; ++i) memberships[i] = engine.uniform_int(g);
+  blockmodel_t blockmodel(memberships, g, N, &adj_list);
+  std::shared_ptr<metropolis_hasting> algorithm = make_case_algorithm(test, g);
+  unsigned int mismatches = 0;
+  unsigned int batch_mismatches = 0;
+  for (unsigned int t = 0; t < 500; ++t)
+  {
+    std::vector<mcmc_move_t> moves = algorithm->sample_proposal_distribution(blockmodel, engine);
+    double expected = brute_force_log_ratio(blockmodel, p, moves);
+    if (!close(std::log(algorithm->transition_ratio(blockmodel, p, moves)), expected)) ++mismatches;
+    double batch;
+    algorithm->log_transition_ratios(blockmodel, p, moves, moves.size(), &batch);
+    if (!close(batch, expected)) ++batch_mismatches;
+    // Move half of the time, so that cached scores are invalidated.
+    if (engine.uniform_real() < 0.5) blockmodel.apply_mcmc_moves(moves);
+    // New states in the same object, whose versions start over: cached scores must not carry over.
+    if (t % 100 == 50) blockmodel.shuffle(engine);
+    if (t % 100 == 99) blockmodel = blockmodel_t(memberships, g, N, &adj_list);
+  }
+  std::ostringstream what;
+  what << test.name << " (g=" << g << ", seed=" << seed << "): " << mismatches << " ratio mismatches";
+  check(mismatches == 0, what.str());
+  what.str("");
+  what << test.name << " (g=" << g << ", seed=" << seed << "): " << batch_mismatches << " batch mismatches";
+  check(batch_mismatches == 0, what.str());
+}
+
+/* The sequential test must take the same decisions as the plain test with the same random numbers. */
+static void check_sequential_test(unsigned int g, double temperature, unsigned int seed)
+{
+  const unsigned int N = 40;
+  adj_list_t adj_list = random_graph(N, 0.3, seed);
+  float_mat_t p = random_probabilities(g, false, seed + 1);
+  uint_vec_t memberships(N);
+  for (unsigned int i = 0; i < N; ++i) memberships[i] = i % g;
+  blockmodel_t plain(memberships, g, N, &adj_list);
+  blockmodel_t sequential(memberships, g, N, &adj_list);
+  std::shared_ptr<metropolis_hasting> plain_algorithm = make_algorithm(false, true, g);
+  std::shared_ptr<metropolis_hasting> sequential_algorithm = make_algorithm(false, true, g);
+  sequential_algorithm->set_sequential_test(1, 0);
+  mt19937_rng_t plain_engine(seed + 2);
+  mt19937_rng_t sequential_engine(seed + 2);
+  for (unsigned int t = 0; t < 20000; ++t)
+  {
+    plain_algorithm->step(plain, p, temperature, plain_engine);
+    sequential_algorithm->step(sequential, p, temperature, sequential_engine);
+  }
+  std::ostringstream what;
+  what << "sequential test (g=" << g << ", T=" << temperature << ") diverged from the plain test";
+  check(plain.get_memberships() == sequential.get_memberships(), what.str());
+  what.str("");
+  what << "sequential test (g=" << g << ", T=" << temperature << ") took no early decision";
+  check(sequential_algorithm->get_early_decisions() > 0, what.str());
+}
+
+int main()
+{
+  std::vector<ratio_case_t> tests = {
+    {"single vertex SBM", false, true, false, false},
+    {"vertices swap SBM", false, false, false, false},
+    {"single vertex PPM", true, true, false, false},
+    {"vertices swap PPM", true, false, false, false},
+    {"single vertex cached", false, true, true, false},
+    {"vertices swap cached", false, false, true, false},
+    {"single vertex SBM (generic)", false, true, false, true},
+    {"vertices swap SBM (generic)", false, false, false, true}
+  };
+  for (auto test = tests.begin(); test != tests.end(); ++test)
+  {
+    for (unsigned int g = 2; g <= 9; ++g)
+    {
+      for (unsigned int seed = 1; seed <= 3; ++seed)
+      {
+        check_ratios(*test, g, 10 * seed + g);
+      }
+    }
+  }
+  for (unsigned int g = 2; g <= 5; ++g)
+  {
+    check_sequential_test(g, 1, g);
+    check_sequential_test(g, 0.5, g);
+  }
+  return test_result();
+}
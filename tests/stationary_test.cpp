@@ -0,0 +1,113 @@
+/* Long-run histograms of the samplers on a tiny graph against the exact distribution
+   over all its partitions, with chi-squared tests. */
+
+#include <memory>
+#include <sstream>
+#include "test_utilities.h"
+
+typedef struct stationary_case_t
+{
+  std::string name;
+  std::shared_ptr<metropolis_hasting> algorithm;
+  bool use_single_vertex;
+  bool use_ppm;
+  double temperature;
+} stationary_case_t;
+
+static const unsigned int N = 6;
+static const unsigned int g = 3;
+static const unsigned int num_samples = 100000;
+static const unsigned int thinning = 40;
+
+static float_mat_t sbm_probabilities()
+{
+  return {{0.7f, 0.1f, 0.25f}, {0.1f, 0.55f, 0.2f}, {0.25f, 0.2f, 0.4f}};
+}
+
+static float_mat_t ppm_probabilities()
+{
+  return {{0.6f, 0.15f, 0.15f}, {0.15f, 0.6f, 0.15f}, {0.15f, 0.15f, 0.6f}};
+}
+
+static void check_stationary(stationary_case_t & test, adj_list_t & adj_list, unsigned int seed)
+{
+  float_mat_t p = test.use_ppm ? ppm_probabilities() : sbm_probabilities();
+  uint_vec_t memberships = {0, 0, 1, 1, 2, 2};
+  std::vector<uint_vec_t> partitions = enumerate_partitions(N, g, test.use_single_vertex ? uint_vec_t() : uint_vec_t(g, 2));
+  std::vector<double> exact = exact_distribution(partitions, g, adj_list, p, test.temperature);
+  std::vector<unsigned int> state(partition_index(uint_vec_t(N, g - 1), g) + 1, 0);
+  for (unsigned int i = 0; i < partitions.size(); ++i) state[partition_index(partitions[i], g)] = i;
+
+  blockmodel_t blockmodel(memberships, g, N, &adj_list);
+  xoshiro_rng_t engine(seed);
+  std::vector<double> counts(partitions.size(), 0);
+  for (unsigned int t = 0; t < 1000; ++t) test.algorithm->step(blockmodel, p, test.temperature, engine);
+  for (unsigned int s = 0; s < num_samples; ++s)
+  {
+    for (unsigned int t = 0; t < thinning; ++t) test.algorithm->step(blockmodel, p, test.temperature, engine);
+    ++counts[state[partition_index(blockmodel.get_memberships(), g)]];
+  }
+  // Chi-squared statistic, with the partitions of expected count below 5 pooled together.
+  double chi_squared = 0;
+  unsigned int cells = 0;
+  double pooled_expected = 0;
+  double pooled_observed = 0;
+  double total_variation = 0;
+  for (unsigned int i = 0; i < partitions.size(); ++i)
+  {
+    double expected = exact[i] * num_samples;
+    total_variation += std::fabs(counts[i] / num_samples - exact[i]) / 2;
+    if (expected < 5)
+    {
+      pooled_expected += expected;
+      pooled_observed += counts[i];
+      continue;
+    }
+    chi_squared += (counts[i] - expected) * (counts[i] - expected) / expected;
+    ++cells;
+  }
+  if (pooled_expected > 0)
+  {
+    chi_squared += (pooled_observed - pooled_expected) * (pooled_observed - pooled_expected) / pooled_expected;
+    ++cells;
+  }
+  double z = chi_squared_z(chi_squared, cells - 1);
+  std::printf("%-40s states %4lu  chi2 %9.1f  df %4u  z %6.2f  TV %.4f\n", test.name.c_str(),
+              partitions.size(), chi_squared, cells - 1, z, total_variation);
+  std::ostringstream what;
+  what << test.name << ": chi-squared z-score " << z;
+  check(z < 5, what.str());
+}
+
+int main()
+{
+  // Two triangles joined by an edge, plus a chord.
+  edge_list_t edge_list = {{0, 1}, {1, 2}, {0, 2}, {3, 4}, {4, 5}, {3, 5}, {2, 3}, {1, 5}};
+  adj_list_t adj_list = edge_to_adj(edge_list, N);
+
+  std::vector<stationary_case_t> tests;
+  tests.push_back({"single vertex SBM (generic)", std::make_shared<mh_single_vertex_sbm>(), true, false, 1});
+  tests.push_back({"single vertex SBM (fixed g)", make_algorithm(false, true, g), true, false, 1});
+  tests.push_back({"single vertex PPM", std::make_shared<mh_single_vertex_ppm>(), true, true, 1});
+  tests.push_back({"single vertex cached", make_algorithm(false, true, g, true), true, false, 1});
+  tests.push_back({"single vertex multiple tries", make_algorithm(false, true, g), true, false, 1});
+  tests.back().algorithm->set_multiple_tries(4);
+  tests.push_back({"single vertex cached multiple tries", make_algorithm(false, true, g, true), true, false, 1});
+  tests.back().algorithm->set_multiple_tries(3);
+  tests.push_back({"single vertex sequential test", make_algorithm(false, true, g), true, false, 1});
+  tests.back().algorithm->set_sequential_test(1, 0);
+  tests.push_back({"single vertex SBM (T=0.7)", make_algorithm(false, true, g), true, false, 0.7});
+  tests.push_back({"single vertex multiple tries (T=0.7)", make_algorithm(false, true, g), true, false, 0.7});
+  tests.back().algorithm->set_multiple_tries(4);
+  tests.push_back({"vertices swap SBM (generic)", std::make_shared<mh_vertices_swap_sbm>(), false, false, 1});
+  tests.push_back({"vertices swap SBM (fixed g)", make_algorithm(false, false, g), false, false, 1});
+  tests.push_back({"vertices swap PPM", std::make_shared<mh_vertices_swap_ppm>(), false, true, 1});
+  tests.push_back({"vertices swap cached", make_algorithm(false, false, g, true), false, false, 1});
+  tests.push_back({"vertices swap multiple tries", make_algorithm(false, false, g), false, false, 1});
+  tests.back().algorithm->set_multiple_tries(4);
+  for (unsigned int i = 0; i < tests.size(); ++i)
+  {
+    check_stationary(tests[i], adj_list, i + 1);
+  }
+  return test_result();
+}
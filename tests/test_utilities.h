@@ -0,0 +1,136 @@
+#ifndef TEST_UTILITIES_H
+#define TEST_UTILITIES_H
+
+/* Helpers of the test executables: tiny graphs, exact enumeration of their partitions and checks.
+   Every test executable returns 0 if all its checks pass. */
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "types.h"
+#include "blockmodel.h"
+#include "metropolis_hasting.h"
+#include "graph_utilities.h"
+
+/* Number of failed checks of the test executable. */
+inline unsigned int & failed_checks()
+{
+  static unsigned int failed = 0;
+  return failed;
+}
+
+inline void check(bool condition, const std::string & what)
+{
+  if (!condition)
+  {
+    ++failed_checks();
+    std::printf("FAILED: %s\n", what.c_str());
+  }
+}
+
+inline int test_result()
+{
+  if (failed_checks() > 0) std::printf("%u check(s) failed\n", failed_checks());
+  return failed_checks() == 0 ? 0 : 1;
+}
+
+/* Graph of N vertices with every pair connected with probability density, from a fixed seed. */
+inline adj_list_t random_graph(unsigned int N, double density, unsigned int seed)
+{
+  mt19937_rng_t engine(seed);
+  edge_list_t edge_list;
+  for (unsigned int i = 0; i < N; ++i)
+  {
+    for (unsigned int j = i + 1; j < N; ++j)
+    {
+      if (engine.uniform_real() < density) edge_list.push_back(edge_t(i, j));
+    }
+  }
+  return edge_to_adj(edge_list, N);
+}
+
+/* Symmetric probability matrix with entries in [low, high), or of the PPM form if ppm. */
+inline float_mat_t random_probabilities(unsigned int g, bool ppm, unsigned int seed, double low=0.05, double high=0.7)
+{
+  mt19937_rng_t engine(seed);
+  float_mat_t p(g, float_vec_t(g));
+  double p_in = low + (high - low) * engine.uniform_real();
+  double p_out = low + (high - low) * engine.uniform_real();
+  for (unsigned int r = 0; r < g; ++r)
+  {
+    for (unsigned int s = r; s < g; ++s)
+    {
+      if (ppm) p[r][s] = (r == s) ? p_in : p_out;
+      else p[r][s] = low + (high - low) * engine.uniform_real();
+      p[s][r] = p[r][s];
+    }
+  }
+  return p;
+}
+
+/* Index of a partition among the g^N partitions of N vertices (base g digits). */
+inline unsigned int partition_index(const uint_vec_t & memberships, unsigned int g)
+{
+  unsigned int index = 0;
+  for (unsigned int i = memberships.size(); i-- > 0;)
+  {
+    index = index * g + memberships[i];
+  }
+  return index;
+}
+
+/* Every partition of N vertices in g blocks, restricted to the block sizes n if not empty. */
+inline std::vector<uint_vec_t> enumerate_partitions(unsigned int N, unsigned int g, const uint_vec_t & n)
+{
+  std::vector<uint_vec_t> partitions;
+  unsigned int count = 1;
+  for (unsigned int i = 0; i < N; ++i) count *= g;
+  for (unsigned int c = 0; c < count; ++c)
+  {
+    uint_vec_t memberships(N);
+    uint_vec_t sizes(g, 0);
+    for (unsigned int i = 0, x = c; i < N; ++i, x /= g)
+    {
+      memberships[i] = x % g;
+      ++sizes[memberships[i]];
+    }
+    if (n.empty() || sizes == n) partitions.push_back(memberships);
+  }
+  return partitions;
+}
+
+/* Probabilities of the partitions, proportional to exp(log-likelihood / temperature). */
+inline std::vector<double> exact_distribution(const std::vector<uint_vec_t> & partitions, unsigned int g,
+                                              adj_list_t & adj_list, const float_mat_t & p, double temperature)
+{
+  std::vector<double> log_weights(partitions.size());
+  double max_log_weight = -INFINITY;
+  for (unsigned int i = 0; i < partitions.size(); ++i)
+  {
+    blockmodel_t blockmodel(partitions[i], g, partitions[i].size(), &adj_list);
+    log_weights[i] = log_likelihood(blockmodel, p) / temperature;
+    max_log_weight = std::max(max_log_weight, log_weights[i]);
+  }
+  std::vector<double> probabilities(partitions.size());
+  double total = 0;
+  for (unsigned int i = 0; i < partitions.size(); ++i)
+  {
+    probabilities[i] = std::exp(log_weights[i] - max_log_weight);
+    total += probabilities[i];
+  }
+  for (unsigned int i = 0; i < partitions.size(); ++i)
+  {
+    probabilities[i] /= total;
+  }
+  return probabilities;
+}
+
+/* Standard normal quantile of a chi-squared statistic with df degrees of freedom (Wilson-Hilferty). */
+inline double chi_squared_z(double chi_squared, unsigned int df)
+{
+  double v = 2. / (9. * df);
+  return (std::cbrt(chi_squared / df) - (1 - v)) / std::sqrt(v);
+}
+
+#endif // TEST_UTILITIES_H